@@ -0,0 +1,611 @@
+/*
+    Mosh: the mobile shell
+    Copyright 2012 Keith Winstein
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations including
+    the two.
+
+    You must obey the GNU General Public License in all respects for all
+    of the code used other than OpenSSL. If you modify file(s) with this
+    exception, you may extend this exception to your version of the
+    file(s), but you are not obligated to do so. If you do not wish to do
+    so, delete this exception statement from your version. If you delete
+    this exception statement from all source files in the program, then
+    also delete it here.
+*/
+
+/* Measures how fast the terminal emulator consumes host output.
+
+   Each workload is run through four pipelines:
+
+     decode    the UTF-8 decoder alone, fed every octet
+     parse     the parser as mosh-server drives it (decoding and the
+               state machine), with the actions thrown away
+     dispatch  the parser plus the dispatcher's work on the actions
+               (parameters, intermediates and function lookup)
+     emulate   Terminal::Complete::act, which also updates the
+               framebuffer
+
+   Each of the last three adds a stage to the one before. decode
+   stands apart: the parser passes runs of printable ASCII on whole
+   and decodes only the other octets, so parse can be the faster of
+   the two.
+
+   For each it reports the speed and the number of calls to operator
+   new per input byte. The workloads are synthetic imitations of common
+   programs, generated deterministically; -w writes them out. Captured
+   pty output (e.g. from "script -q -c command capture.raw") can be
+   given as files to be measured the same way. */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <new>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#if HAVE_CLOCK_GETTIME
+#include <time.h>
+#else
+#include <sys/time.h>
+#endif
+
+#include "parser.h"
+#include "parseraction.h"
+#include "terminaldispatcher.h"
+#include "completeterminal.h"
+#include "locale_utils.h"
+#include "fatal_assert.h"
+
+using std::string;
+using std::vector;
+
+/* count every allocation made through operator new */
+
+static uint64_t allocations = 0;
+
+#if __cplusplus >= 201103L
+#define NEW_THROWS
+#define DELETE_THROWS noexcept
+#else
+#define NEW_THROWS throw ( std::bad_alloc )
+#define DELETE_THROWS throw ()
+#endif
+
+void *operator new( size_t size ) NEW_THROWS
+{
+  allocations++;
+  void *p = malloc( size ? size : 1 );
+  if ( p == NULL ) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete( void *p ) DELETE_THROWS
+{
+  free( p );
+}
+
+static uint64_t now_ns( void )
+{
+#if HAVE_CLOCK_GETTIME
+  struct timespec tp;
+  fatal_assert( clock_gettime( CLOCK_MONOTONIC, &tp ) == 0 );
+  return uint64_t( tp.tv_sec ) * 1000000000 + tp.tv_nsec;
+#else
+  struct timeval tv;
+  fatal_assert( gettimeofday( &tv, NULL ) == 0 );
+  return uint64_t( tv.tv_sec ) * 1000000000 + uint64_t( tv.tv_usec ) * 1000;
+#endif
+}
+
+/* workload generators */
+
+static uint32_t rand_state;
+
+static uint32_t rnd( uint32_t n )
+{
+  rand_state = rand_state * 1103515245 + 12345;
+  return ( rand_state >> 8 ) % n;
+}
+
+static void append_utf8( string &s, uint32_t c )
+{
+  if ( c < 0x80 ) {
+    s += char( c );
+  } else if ( c < 0x800 ) {
+    s += char( 0xC0 | (c >> 6) );
+    s += char( 0x80 | (c & 0x3F) );
+  } else if ( c < 0x10000 ) {
+    s += char( 0xE0 | (c >> 12) );
+    s += char( 0x80 | ((c >> 6) & 0x3F) );
+    s += char( 0x80 | (c & 0x3F) );
+  } else {
+    s += char( 0xF0 | (c >> 18) );
+    s += char( 0x80 | ((c >> 12) & 0x3F) );
+    s += char( 0x80 | ((c >> 6) & 0x3F) );
+    s += char( 0x80 | (c & 0x3F) );
+  }
+}
+
+static string num( int n )
+{
+  char buf[ 16 ];
+  snprintf( buf, sizeof( buf ), "%d", n );
+  return buf;
+}
+
+static string cup( int row, int col )
+{
+  return "\033[" + num( row ) + ";" + num( col ) + "H";
+}
+
+static const char *const words[] = {
+  "the", "of", "terminal", "and", "a", "to", "state", "in", "is", "mosh",
+  "server", "client", "that", "for", "it", "with", "as", "was", "on", "be",
+  "screen", "by", "framebuffer", "at", "this", "from", "or", "an", "which",
+  "synchronization", "protocol", "roaming", "prediction", "latency", "UDP" };
+
+static string word( void )
+{
+  return words[ rnd( sizeof( words ) / sizeof( words[ 0 ] ) ) ];
+}
+
+static string identifier( void )
+{
+  static const char *const parts[] = { "frame", "row", "cell", "get", "set", "draw",
+				       "state", "width", "buf", "next", "count", "size" };
+  string s = parts[ rnd( 12 ) ];
+  for ( int i = rnd( 3 ); i > 0; i-- ) {
+    s += "_";
+    s += parts[ rnd( 12 ) ];
+  }
+  return s;
+}
+
+/* "cat" of prose: plain ASCII lines */
+static void gen_cat( string &out, size_t bytes, int width, int height __attribute__((unused)) )
+{
+  while ( out.size() < bytes ) {
+    string line;
+    size_t len = rnd( 4 ) ? rnd( width * 3 / 2 ) : 0;
+    while ( line.size() < len ) {
+      line += word();
+      line += rnd( 10 ) ? " " : ". ";
+    }
+    out += line + "\r\n";
+  }
+}
+
+/* "ls --color" in columns */
+static void gen_ls( string &out, size_t bytes, int width, int height __attribute__((unused)) )
+{
+  static const char *const colors[] = { "01;34", "01;32", "01;36", "01;31", "01;35", "00" };
+  static const char *const extensions[] = { "", ".cc", ".h", ".o", ".tar.gz", ".png", ".sh" };
+
+  while ( out.size() < bytes ) {
+    int column_width = 12 + rnd( 12 );
+    for ( int col = 0; col + column_width <= width; col += column_width ) {
+      string name = identifier() + extensions[ rnd( 7 ) ];
+      name = name.substr( 0, column_width - 2 );
+      const char *color = colors[ rnd( 6 ) ];
+      if ( strcmp( color, "00" ) != 0 ) {
+	out += string( "\033[0m\033[" ) + color + "m" + name + "\033[0m";
+      } else {
+	out += name;
+      }
+      out += string( column_width - name.size(), ' ' );
+    }
+    out += "\r\n";
+  }
+}
+
+static string code_line( int width )
+{
+  static const char *const keywords[] = { "if", "for", "return", "int", "const", "static", "void" };
+  string line( rnd( 4 ) * 2, ' ' );
+  size_t visible = line.size();
+  while ( visible < size_t( width * 2 / 3 ) ) {
+    string token;
+    string sgr;
+    switch ( rnd( 5 ) ) {
+    case 0: token = keywords[ rnd( 7 ) ]; sgr = "\033[38;5;130m"; break;
+    case 1: token = "\"" + word() + "\""; sgr = "\033[38;5;161m"; break;
+    case 2: token = num( rnd( 1000 ) ); sgr = "\033[38;5;161m"; break;
+    case 3: token = "/* " + word() + " */"; sgr = "\033[38;5;33m"; break;
+    default: token = identifier() + "( "; break;
+    }
+    line += sgr.empty() ? token : sgr + token + "\033[m";
+    line += " ";
+    visible += token.size() + 1;
+  }
+  return line;
+}
+
+/* vim scrolling through a file a line at a time */
+static void gen_vim( string &out, size_t bytes, int width, int height )
+{
+  out += "\033[?1049h\033[1;" + num( height ) + "r\033[?12l\033[?25h\033[m\033[H\033[2J";
+  int line = 1;
+  while ( out.size() < bytes ) {
+    out += "\033[?25l\033[1;" + num( height - 1 ) + "r" + cup( height - 1, 1 ) + "\n";
+    out += "\033[1;" + num( height ) + "r" + cup( height - 1, 1 );
+    char number[ 16 ];
+    snprintf( number, sizeof( number ), "%4d ", line );
+    out += string( "\033[38;5;130m" ) + number + "\033[m";
+    out += code_line( width - 5 ) + "\033[K";
+    out += cup( height, width - 17 ) + num( line ) + ",1" + "\033[10C" + num( line * 100 / 5000 ) + "%";
+    out += cup( height - 1, 6 ) + "\033[?25h";
+    line++;
+  }
+}
+
+/* htop redrawing meters and the process list */
+static void gen_htop( string &out, size_t bytes, int width, int height )
+{
+  while ( out.size() < bytes ) {
+    out += "\033[?25l";
+    for ( int cpu = 0; cpu < 4; cpu++ ) {
+      int bar = std::max( width / 2 - 10, 1 );
+      int used = rnd( bar );
+      int kernel = rnd( bar - used + 1 );
+      out += cup( cpu + 1, 3 ) + "\033[39;49m\033[1m" + num( cpu + 1 ) + "\033[m\033[37m[\033[32m";
+      out += string( used, '|' ) + "\033[31m" + string( kernel, '|' ) + "\033[30;1m";
+      out += string( bar - used - kernel, ' ' ) + "\033[37m" + num( rnd( 100 ) ) + "." + num( rnd( 10 ) ) + "%\033[m\033[37m]";
+    }
+    out += cup( 6, 1 ) + "\033[30;42m  PID USER      PRI  NI  VIRT   RES S CPU% MEM%   TIME+  Command\033[K";
+    for ( int row = 7; row <= height; row++ ) {
+      out += cup( row, 1 ) + ( rnd( 20 ) ? "\033[m" : "\033[30;46m" );
+      char buf[ 128 ];
+      snprintf( buf, sizeof( buf ), "%5d \033[36m%-9s\033[m %3d %3d %5dM %5dM %c %4.1f %4.1f %3d:%02d.%02d ",
+		int( 1 + rnd( 32000 ) ), word().c_str(), int( rnd( 40 ) ), int( rnd( 20 ) ),
+		int( rnd( 4096 ) ), int( rnd( 512 ) ), rnd( 8 ) ? 'S' : 'R',
+		rnd( 1000 ) / 10.0, rnd( 1000 ) / 10.0, int( rnd( 60 ) ), int( rnd( 60 ) ), int( rnd( 100 ) ) );
+      out += buf;
+      out += "\033[1m" + identifier() + "\033[m " + word() + "\033[K";
+    }
+    out += "\033[?25h";
+  }
+}
+
+/* a build log with colored compiler diagnostics */
+static void gen_compile( string &out, size_t bytes, int width __attribute__((unused)),
+			 int height __attribute__((unused)) )
+{
+  while ( out.size() < bytes ) {
+    string file = "src/" + identifier() + ".cc";
+    if ( rnd( 4 ) ) {
+      out += "g++ -DHAVE_CONFIG_H -I. -I../.. -I../util -I../terminal -Wall -O2 -g -pipe -MT "
+	+ file + ".o -MD -MP -MF .deps/" + identifier() + ".Tpo -c -o " + identifier() + ".o " + file + "\r\n";
+      continue;
+    }
+    string location = file + ":" + num( 1 + rnd( 900 ) ) + ":" + num( 1 + rnd( 60 ) ) + ":";
+    string name = identifier();
+    out += "\033[01m\033[K" + location + "\033[m\033[K \033[01;35m\033[Kwarning: \033[m\033[Kunused variable '\033[01m\033[K"
+      + name + "\033[m\033[K' [\033[01;35m\033[K-Wunused-variable\033[m\033[K]\r\n";
+    out += "  " + num( 1 + rnd( 900 ) ) + " |   int \033[01;35m\033[K" + name + "\033[m\033[K = " + num( rnd( 100 ) ) + ";\r\n";
+    out += "      |       \033[01;35m\033[K^" + string( name.size() - 1, '~' ) + "\033[m\033[K\r\n";
+  }
+}
+
+/* text in several scripts, with wide and combining characters */
+static void gen_utf8( string &out, size_t bytes, int width, int height __attribute__((unused)) )
+{
+  while ( out.size() < bytes ) {
+    int columns = 0;
+    int len = rnd( width * 3 / 2 );
+    while ( columns < len ) {
+      switch ( rnd( 6 ) ) {
+      case 0: append_utf8( out, 0x4E00 + rnd( 0x5000 ) ); columns += 2; break; /* CJK */
+      case 1: append_utf8( out, 0x3041 + rnd( 0x56 ) ); columns += 2; break; /* hiragana */
+      case 2: append_utf8( out, 0x0430 + rnd( 0x20 ) ); columns++; break; /* Cyrillic */
+      case 3: append_utf8( out, 'a' + rnd( 26 ) ); append_utf8( out, 0x0300 + rnd( 0x10 ) ); columns++; break;
+      case 4: append_utf8( out, 0x1F600 + rnd( 0x40 ) ); columns += 2; break; /* emoji */
+      default: out += word() + " "; columns += 4; break;
+      }
+    }
+    out += "\r\n";
+  }
+}
+
+struct Generator {
+  const char *name;
+  void (*generate)( string &out, size_t bytes, int width, int height );
+};
+
+static const Generator generators[] = {
+  { "cat", gen_cat },
+  { "ls", gen_ls },
+  { "vim", gen_vim },
+  { "htop", gen_htop },
+  { "compile", gen_compile },
+  { "utf8", gen_utf8 },
+};
+
+/* pipelines */
+
+class NullSink {
+public:
+  template <class T> void act( const T &action __attribute__((unused)) ) {}
+  void print_run( const char *s __attribute__((unused)), size_t len __attribute__((unused)) ) {}
+};
+
+/* does what the Dispatcher does with the parser's actions, short of
+   calling the functions it finds */
+class DispatchSink {
+private:
+  Terminal::Dispatcher dispatcher;
+
+  void lookup( Terminal::Function_Type type, wchar_t final )
+  {
+    const string &chars = dispatcher.get_dispatch_chars();
+    char key[ 3 ];
+    if ( (final > 255) || (chars.size() > 1) ) {
+      return;
+    }
+    memcpy( key, chars.data(), chars.size() );
+    key[ chars.size() ] = final;
+    Terminal::Function *f = Terminal::get_global_dispatch_registry().slot( type, key, chars.size() + 1 );
+    if ( f && f->function ) {
+      found += dispatcher.getparam( 0, 1 ) + dispatcher.getparam( 1, 1 );
+    }
+  }
+
+public:
+  uint64_t found;
+
+  DispatchSink() : dispatcher(), found( 0 ) {}
+
+  template <class T> void act( const T &action __attribute__((unused)) ) {}
+  void print_run( const char *s __attribute__((unused)), size_t len __attribute__((unused)) ) {}
+
+  void act( const Parser::Param &action ) { dispatcher.newparamchar( &action ); }
+  void act( const Parser::Collect &action ) { dispatcher.collect( &action ); }
+  void act( const Parser::Clear &action ) { dispatcher.clear( &action ); }
+  void act( const Parser::Esc_Dispatch &action ) { lookup( Terminal::ESCAPE, action.ch ); }
+  void act( const Parser::CSI_Dispatch &action ) { lookup( Terminal::CSI, action.ch ); }
+  void act( const Parser::Execute &action )
+  {
+    if ( (action.ch >= 0) && (action.ch <= 255) ) {
+      found += Terminal::get_global_dispatch_registry().control[ action.ch ].clears_wrap_state;
+    }
+  }
+};
+
+enum Stage { DECODE, PARSE, DISPATCH, EMULATE, NUM_STAGES };
+static const char *const stage_names[ NUM_STAGES ] = { "decode", "parse", "dispatch", "emulate" };
+
+static int width = 80, height = 24;
+
+/* results go here so that the work cannot be optimized away */
+static volatile uint64_t results;
+
+/* one pass over the input; returns something derived from the results */
+static uint64_t run( Stage stage, const vector<string> &chunks )
+{
+  uint64_t result = 0;
+
+  switch ( stage ) {
+  case DECODE: {
+    Parser::UTF8Parser parser;
+    wchar_t chars[ 2 ];
+    for ( size_t i = 0; i < chunks.size(); i++ ) {
+      const string &chunk = chunks[ i ];
+      for ( size_t j = 0; j < chunk.size(); j++ ) {
+	size_t n = parser.decode( chunk[ j ], chars );
+	result += n ? chars[ n - 1 ] : 0;
+      }
+    }
+    break;
+  }
+  case PARSE: {
+    Parser::UTF8Parser parser;
+    NullSink sink;
+    for ( size_t i = 0; i < chunks.size(); i++ ) {
+      parser.input( chunks[ i ].data(), chunks[ i ].size(), sink );
+    }
+    result = parser.is_grounded();
+    break;
+  }
+  case DISPATCH: {
+    Parser::UTF8Parser parser;
+    DispatchSink sink;
+    for ( size_t i = 0; i < chunks.size(); i++ ) {
+      parser.input( chunks[ i ].data(), chunks[ i ].size(), sink );
+    }
+    result = sink.found;
+    break;
+  }
+  case EMULATE: {
+    Terminal::Complete terminal( width, height );
+    for ( size_t i = 0; i < chunks.size(); i++ ) {
+      result += terminal.act( chunks[ i ] ).size();
+    }
+    result += terminal.get_fb().ds.get_cursor_row();
+    break;
+  }
+  default:
+    fatal_assert( false );
+  }
+
+  return result;
+}
+
+static void measure( const string &name, const string &data, size_t chunk_size, int repetitions )
+{
+  vector<string> chunks;
+  for ( size_t i = 0; i < data.size(); i += chunk_size ) {
+    chunks.push_back( data.substr( i, chunk_size ) );
+  }
+
+  for ( int stage = 0; stage < NUM_STAGES; stage++ ) {
+    uint64_t best = uint64_t( -1 );
+    uint64_t allocs = 0;
+    for ( int rep = 0; rep < repetitions; rep++ ) {
+      uint64_t allocations_before = allocations;
+      uint64_t start = now_ns();
+      results += run( Stage( stage ), chunks );
+      uint64_t elapsed = now_ns() - start;
+      if ( elapsed < best ) {
+	best = elapsed;
+      }
+      allocs = allocations - allocations_before;
+    }
+
+    double ns_per_byte = double( best ) / data.size();
+    printf( "%-10s %10lu  %-9s %9.1f %9.2f %12.4f\n",
+	    stage ? "" : name.c_str(), (unsigned long)data.size(), stage_names[ stage ],
+	    1000.0 / ns_per_byte, ns_per_byte, double( allocs ) / data.size() );
+  }
+}
+
+static bool read_file( const char *filename, string &out )
+{
+  FILE *f = fopen( filename, "rb" );
+  if ( f == NULL ) {
+    perror( filename );
+    return false;
+  }
+
+  char buf[ 65536 ];
+  size_t n;
+  while ( (n = fread( buf, 1, sizeof( buf ), f )) > 0 ) {
+    out.append( buf, n );
+  }
+
+  bool ok = !ferror( f );
+  if ( !ok ) {
+    perror( filename );
+  }
+  fclose( f );
+  return ok;
+}
+
+static bool write_file( const string &filename, const string &data )
+{
+  FILE *f = fopen( filename.c_str(), "wb" );
+  if ( f == NULL ) {
+    perror( filename.c_str() );
+    return false;
+  }
+
+  bool ok = (fwrite( data.data(), 1, data.size(), f ) == data.size());
+  if ( fclose( f ) != 0 ) {
+    ok = false;
+  }
+  if ( !ok ) {
+    perror( filename.c_str() );
+  }
+  return ok;
+}
+
+static void usage( const char *argv0 )
+{
+  fprintf( stderr, "Usage: %s [-s MB] [-r REPETITIONS] [-c CHUNK] [-g COLSxROWS] [-n] [-w DIR] [CAPTURE...]\n"
+	   "  -s  size of each generated workload (default 4 MB)\n"
+	   "  -r  passes per measurement, fastest is reported (default 5)\n"
+	   "  -c  bytes handed to the emulator at a time (default 16384, as mosh-server reads)\n"
+	   "  -g  screen size, at least 20x2 (default 80x24)\n"
+	   "  -n  skip the generated workloads\n"
+	   "  -w  write the generated workloads to DIR/NAME.raw and exit\n", argv0 );
+}
+
+int main( int argc, char *argv[] )
+{
+  size_t megabytes = 4;
+  int repetitions = 5;
+  size_t chunk_size = 16384;
+  bool generated = true;
+  const char *write_dir = NULL;
+
+  int opt;
+  while ( (opt = getopt( argc, argv, "s:r:c:g:nw:" )) != -1 ) {
+    switch ( opt ) {
+    case 's': megabytes = strtoul( optarg, NULL, 10 ); break;
+    case 'r': repetitions = atoi( optarg ); break;
+    case 'c': chunk_size = strtoul( optarg, NULL, 10 ); break;
+    case 'g':
+      if ( sscanf( optarg, "%dx%d", &width, &height ) != 2 ) {
+	usage( argv[ 0 ] );
+	return 1;
+      }
+      break;
+    case 'n': generated = false; break;
+    case 'w': write_dir = optarg; break;
+    default: usage( argv[ 0 ] ); return 1;
+    }
+  }
+
+  if ( (megabytes == 0) || (repetitions < 1) || (chunk_size == 0)
+       || (width < 20) || (height < 2) ) {
+    usage( argv[ 0 ] );
+    return 1;
+  }
+
+  /* the emulator still needs a UTF-8 locale for everything else */
+  set_native_locale();
+
+  vector< std::pair<string, string> > workloads;
+  if ( generated || write_dir ) {
+    for ( size_t i = 0; i < sizeof( generators ) / sizeof( generators[ 0 ] ); i++ ) {
+      string data;
+      rand_state = i + 1;
+      generators[ i ].generate( data, megabytes << 20, width, height );
+      workloads.push_back( std::make_pair( string( generators[ i ].name ), data ) );
+    }
+  }
+
+  if ( write_dir ) {
+    for ( size_t i = 0; i < workloads.size(); i++ ) {
+      if ( !write_file( string( write_dir ) + "/" + workloads[ i ].first + ".raw", workloads[ i ].second ) ) {
+	return 1;
+      }
+    }
+    return 0;
+  }
+
+  for ( int i = optind; i < argc; i++ ) {
+    string data;
+    if ( !read_file( argv[ i ], data ) ) {
+      return 1;
+    }
+    string name = argv[ i ];
+    size_t slash = name.rfind( '/' );
+    if ( slash != string::npos ) {
+      name = name.substr( slash + 1 );
+    }
+    workloads.push_back( std::make_pair( name, data ) );
+  }
+
+  printf( "%-10s %10s  %-9s %9s %9s %12s\n", "workload", "bytes", "stage", "MB/s", "ns/byte", "allocs/byte" );
+  for ( size_t i = 0; i < workloads.size(); i++ ) {
+    if ( !workloads[ i ].second.empty() ) {
+      measure( workloads[ i ].first, workloads[ i ].second, chunk_size, repetitions );
+    }
+  }
+
+  return 0;
+}
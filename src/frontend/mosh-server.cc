@@ -53,6 +53,7 @@
 #include <netdb.h>
 #include <time.h>
 #include <sys/stat.h>
+#include <poll.h>
 
 #ifdef HAVE_UTMPX_H
 #include <utmpx.h>
@@ -73,7 +74,6 @@
 #endif
 
 #include "completeterminal.h"
-#include "swrite.h"
 #include "user.h"
 #include "fatal_assert.h"
 #include "locale_utils.h"
@@ -92,7 +92,8 @@ typedef Network::Transport< Terminal::Complete, Network::UserStream > ServerConn
 
 void serve( int host_fd,
 	    Terminal::Complete &terminal,
-	    ServerConnection &network );
+	    ServerConnection &network,
+	    bool verbose );
 
 int run_server( const char *desired_ip, const char *desired_port,
 		const string &command_path, char *command_argv[],
@@ -488,7 +489,7 @@ int run_server( const char *desired_ip, const char *desired_port,
 #endif
 
     try {
-      serve( master, terminal, *network );
+      serve( master, terminal, *network, verbose );
     } catch ( const Network::NetworkException& e ) {
       fprintf( stderr, "Network exception: %s: %s\n",
 	       e.function.c_str(), strerror( e.the_errno ) );
@@ -514,8 +515,63 @@ int run_server( const char *desired_ip, const char *desired_port,
   return 0;
 }
 
-void serve( int host_fd, Terminal::Complete &terminal, ServerConnection &network )
+/* true if fd can be read without blocking */
+static bool readable_now( int fd )
 {
+  struct pollfd pfd;
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  return (poll( &pfd, 1, 0 ) == 1) && (pfd.revents & POLLIN);
+}
+
+/* Writes as much of queue to the (non-blocking) fd as it will take
+   and removes that from the front. Returns false on error. */
+static bool flush_to_host( int fd, string &queue )
+{
+  size_t written = 0;
+  while ( written < queue.size() ) {
+    ssize_t bytes_written = write( fd, queue.data() + written, queue.size() - written );
+    if ( bytes_written < 0 ) {
+      if ( errno == EINTR ) {
+	continue;
+      } else if ( (errno == EAGAIN) || (errno == EWOULDBLOCK) ) {
+	break;
+      }
+      perror( "write" );
+      return false;
+    }
+    written += bytes_written;
+  }
+
+  queue.erase( 0, written );
+  return true;
+}
+
+void serve( int host_fd, Terminal::Complete &terminal, ServerConnection &network, bool verbose )
+{
+  /* Longest time, in milliseconds, spent emulating host output before
+     looking at the network again. */
+  int host_slice = 5;
+  const char *slice_env = getenv( "MOSH_SERVER_SLICE_MS" );
+  if ( slice_env && *slice_env ) {
+    host_slice = max( 1, atoi( slice_env ) );
+  }
+
+  /* Octets for the host (user input and replies to terminal queries)
+     are queued and written as the host takes them, so an application
+     that stops reading cannot stall the server. Past the limit, new
+     user input is refused until the queue drains; the client keeps
+     resending it. */
+  string to_host;
+  const size_t host_backlog_limit = 65536;
+
+  int host_flags = fcntl( host_fd, F_GETFL );
+  if ( (host_flags < 0) || (fcntl( host_fd, F_SETFL, host_flags | O_NONBLOCK ) < 0) ) {
+    perror( "fcntl" );
+    return;
+  }
+
   /* prepare to poll for events */
   Select &sel = Select::get_instance();
   sel.add_signal( SIGTERM );
@@ -547,9 +603,16 @@ void serve( int host_fd, Terminal::Complete &terminal, ServerConnection &network
       assert( fd_list.size() == 1 ); /* servers don't hop */
       int network_fd = fd_list.back();
       sel.add_fd( network_fd );
-      if ( !network.shutdown_in_progress() ) {
+      /* while the host is not taking its input, leave its output in
+	 the pty rather than queue up more replies to it */
+      bool read_host = (!network.shutdown_in_progress())
+	&& (to_host.size() <= host_backlog_limit);
+      if ( read_host ) {
 	sel.add_fd( host_fd );
       }
+      if ( (!network.shutdown_in_progress()) && (!to_host.empty()) ) {
+	sel.add_write_fd( host_fd );
+      }
 
       int active_fds = sel.select( timeout );
       if ( active_fds < 0 ) {
@@ -560,10 +623,22 @@ void serve( int host_fd, Terminal::Complete &terminal, ServerConnection &network
       now = Network::timestamp();
       uint64_t time_since_remote_state = now - network.get_latest_remote_state().timestamp;
 
+      if ( (!network.shutdown_in_progress()) && sel.write( host_fd ) ) {
+	if ( !flush_to_host( host_fd, to_host ) ) {
+	  break;
+	}
+      }
+
       if ( sel.read( network_fd ) ) {
-	/* packet received from the network */
+	/* packets received from the network; take all that have
+	   arrived, so the newest user input is applied before any
+	   more host output */
+	network.hold_new_states( to_host.size() > host_backlog_limit );
 	network.recv();
-	
+	while ( readable_now( network_fd ) ) {
+	  network.recv();
+	}
+
 	/* is new user input available for the terminal? */
 	if ( network.get_remote_state_num() != last_remote_num ) {
 	  last_remote_num = network.get_remote_state_num();
@@ -603,7 +678,8 @@ void serve( int host_fd, Terminal::Complete &terminal, ServerConnection &network
 	  }
 	  
 	  /* write any writeback octets back to the host */
-	  if ( swrite( host_fd, terminal_to_host.c_str(), terminal_to_host.length() ) < 0 ) {
+	  to_host += terminal_to_host;
+	  if ( !flush_to_host( host_fd, to_host ) ) {
 	    break;
 	  }
 
@@ -636,26 +712,54 @@ void serve( int host_fd, Terminal::Complete &terminal, ServerConnection &network
 	}
       }
       
-      if ( (!network.shutdown_in_progress()) && sel.read( host_fd ) ) {
-	/* input from the host needs to be fed to the terminal */
+      if ( read_host && (!network.shutdown_in_progress()) && sel.read( host_fd ) ) {
+	/* Input from the host needs to be fed to the terminal. Keep
+	   reading it for one slice, which ends early if a frame is due
+	   or the host goes quiet; anything left waits in the pty until
+	   the network has had its turn. */
 	const int buf_size = 16384;
 	char buf[ buf_size ];
-	
-	/* fill buffer if possible */
-	ssize_t bytes_read = read( host_fd, buf, buf_size );
 
-        /* If the pty slave is closed, reading from the master can fail with
-           EIO (see #264).  So we treat errors on read() like EOF. */
-        if ( bytes_read <= 0 ) {
-	  network.start_shutdown();
-	} else {
-	  string terminal_to_host = terminal.act( string( buf, bytes_read ) );
-	
+	const uint64_t slice_end = now + min( host_slice, network.wait_time() );
+	string terminal_to_host;
+	int reads = 0;
+	size_t bytes = 0;
+
+	do {
+	  /* fill buffer if possible */
+	  ssize_t bytes_read = read( host_fd, buf, buf_size );
+	  if ( (bytes_read < 0)
+	       && ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) ) {
+	    break;
+	  }
+
+	  /* If the pty slave is closed, reading from the master can fail with
+	     EIO (see #264).  So we treat errors on read() like EOF. */
+	  if ( bytes_read <= 0 ) {
+	    network.start_shutdown();
+	    break;
+	  }
+
+	  terminal_to_host += terminal.act( string( buf, bytes_read ) );
+	  reads++;
+	  bytes += bytes_read;
+
+	  freeze_timestamp();
+	} while ( (frozen_timestamp() < slice_end) && readable_now( host_fd ) );
+
+	if ( verbose && reads ) {
+	  fprintf( stderr, "[%u] Host slice: %d reads, %d bytes in %d ms (limit %d ms)\n",
+		   (unsigned int)(frozen_timestamp() % 100000), reads, (int)bytes,
+		   (int)(frozen_timestamp() - now), (int)(slice_end - now) );
+	}
+
+	if ( reads ) {
 	  /* update client with new state of terminal */
 	  network.set_current_state( terminal );
 
 	  /* write any writeback octets back to the host */
-	  if ( swrite( host_fd, terminal_to_host.c_str(), terminal_to_host.length() ) < 0 ) {
+	  to_host += terminal_to_host;
+	  if ( !flush_to_host( host_fd, to_host ) ) {
 	    break;
 	  }
 	}
@@ -271,10 +271,8 @@ void STMClient::output_new_frame( void )
   display.downgrade( *new_state );
 
   /* calculate minimal difference from where we are */
-  const string diff( display.new_frame( !repaint_requested,
-					*local_framebuffer,
-					*new_state ) );
-  swrite( STDOUT_FILENO, diff.data(), diff.size() );
+  display.new_frame( !repaint_requested, *local_framebuffer, *new_state, display_output );
+  swrite( STDOUT_FILENO, display_output.data(), display_output.size() );
 
   repaint_requested = false;
 
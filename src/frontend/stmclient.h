@@ -62,6 +62,7 @@ private:
   Overlay::OverlayManager overlays;
   Network::Transport< Network::UserStream, Terminal::Complete > *network;
   Terminal::Display display;
+  std::string display_output; /* reused from frame to frame */
 
   std::wstring connecting_notification;
   bool repaint_requested, lf_entered, quit_sequence_started;
@@ -94,6 +95,7 @@ public:
       overlays(),
       network( NULL ),
       display( true ), /* use TERM environment var to initialize display */
+      display_output(),
       connecting_notification(),
       repaint_requested( false ),
       lf_entered( false ),
@@ -37,6 +37,7 @@
 #include <limits.h>
 
 #include "terminaloverlay.h"
+#include "terminalwidth.h"
 
 using namespace Overlay;
 using std::max;
@@ -61,7 +62,7 @@ void ConditionalOverlayCell::apply( Framebuffer &fb, uint64_t confirmed_epoch, i
 
   if ( unknown ) {
     if ( flag && ( col != fb.ds.get_width() - 1 ) ) {
-      fb.get_mutable_cell( row, col )->renditions.underlined = true;
+      fb.get_mutable_cell( row, col )->renditions.set_attribute( Renditions::underlined, true );
     }
     return;
   }
@@ -69,7 +70,7 @@ void ConditionalOverlayCell::apply( Framebuffer &fb, uint64_t confirmed_epoch, i
   if ( !(*(fb.get_cell( row, col )) == replacement) ) {
     *(fb.get_mutable_cell( row, col )) = replacement;
     if ( flag ) {
-      fb.get_mutable_cell( row, col )->renditions.underlined = true;
+      fb.get_mutable_cell( row, col )->renditions.set_attribute( Renditions::underlined, true );
     }
   }
 }
@@ -205,9 +206,9 @@ void NotificationEngine::apply( Framebuffer &fb ) const
 
   /* draw bar across top of screen */
   Cell notification_bar( 0 );
-  notification_bar.renditions.foreground_color = 37;
-  notification_bar.renditions.background_color = 44;
-  notification_bar.contents.push_back( 0x20 );
+  notification_bar.renditions.set_foreground_color( 7 );
+  notification_bar.renditions.set_background_color( 4 );
+  notification_bar.append( 0x20 );
 
   for ( int i = 0; i < fb.ds.get_width(); i++ ) {
     *(fb.get_mutable_cell( 0, i )) = notification_bar;
@@ -267,7 +268,7 @@ void NotificationEngine::apply( Framebuffer &fb ) const
     }
 
     wchar_t ch = *i;
-    int chwidth = ch == L'\0' ? -1 : wcwidth( ch );
+    int chwidth = ch == L'\0' ? -1 : Terminal::char_width( ch );
     Cell *this_cell = 0;
 
     switch ( chwidth ) {
@@ -275,11 +276,11 @@ void NotificationEngine::apply( Framebuffer &fb ) const
     case 2: /* wide character */
       this_cell = fb.get_mutable_cell( 0, overlay_col );
       fb.reset_cell( this_cell );
-      this_cell->renditions.bold = true;
-      this_cell->renditions.foreground_color = 37;
-      this_cell->renditions.background_color = 44;
+      this_cell->renditions.set_attribute( Renditions::bold, true );
+      this_cell->renditions.set_foreground_color( 7 );
+      this_cell->renditions.set_background_color( 4 );
       
-      this_cell->contents.push_back( ch );
+      this_cell->append( ch );
       this_cell->width = chwidth;
       combining_cell = this_cell;
 
@@ -290,14 +291,14 @@ void NotificationEngine::apply( Framebuffer &fb ) const
 	break;
       }
 
-      if ( combining_cell->contents.size() == 0 ) {
+      if ( combining_cell->empty() ) {
 	assert( combining_cell->width == 1 );
 	combining_cell->fallback = true;
 	overlay_col++;
       }
 
-      if ( combining_cell->contents.size() < 16 ) {
-	combining_cell->contents.push_back( ch );
+      if ( !combining_cell->full() ) {
+	combining_cell->append( ch );
       }
       break;
     case -1: /* unprintable character */
@@ -725,7 +726,7 @@ void PredictionEngine::new_user_byte( char the_byte, const Framebuffer &fb )
 	    }
 	  }
 	}
-      } else if ( (ch < 0x20) || (wcwidth( ch ) != 1) ) {
+      } else if ( (ch < 0x20) || (Terminal::char_width( ch ) != 1) ) {
 	/* unknown print */
 	become_tentative();
 	//	fprintf( stderr, "Unknown print 0x%x\n", ch );
@@ -788,8 +789,8 @@ void PredictionEngine::new_user_byte( char the_byte, const Framebuffer &fb )
 	  }
 	}
 
-	cell.replacement.contents.clear();
-	cell.replacement.contents.push_back( ch );
+	cell.replacement.clear();
+	cell.replacement.append( ch );
 	cell.original_contents.push_back( *fb.get_cell( cursor().row, cursor().col ) );
 
 	/*
@@ -876,7 +877,7 @@ void PredictionEngine::newline_carriage_return( const Framebuffer &fb )
       j->active = true;
       j->tentative_until_epoch = prediction_epoch;
       j->expire( local_frame_sent + 1, now );
-      j->replacement.contents.clear();
+      j->replacement.clear();
     }
   } else {
     cursor().row++;
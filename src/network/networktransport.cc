@@ -46,6 +46,7 @@ Transport<MyState, RemoteState>::Transport( MyState &initial_state, RemoteState
     sender( &connection, initial_state ),
     received_states( 1, TimestampedState<RemoteState>( timestamp(), 0, initial_remote ) ),
     receiver_quench_timer( 0 ),
+    holding_new_states( false ),
     last_receiver_state( initial_remote ),
     fragments(),
     verbose( false )
@@ -60,6 +61,7 @@ Transport<MyState, RemoteState>::Transport( MyState &initial_state, RemoteState
     sender( &connection, initial_state ),
     received_states( 1, TimestampedState<RemoteState>( timestamp(), 0, initial_remote ) ),
     receiver_quench_timer( 0 ),
+    holding_new_states( false ),
     last_receiver_state( initial_remote ),
     fragments(),
     verbose( false )
@@ -117,6 +119,17 @@ void Transport<MyState, RemoteState>::recv( void )
 
     process_throwaway_until( inst.throwaway_num() );
 
+    if ( holding_new_states ) {
+      /* the remote side is still there and sending; keep the sender's
+	 retry timer going so it keeps retransmitting what it has */
+      sender.remote_heard( timestamp() );
+      if ( verbose ) {
+	fprintf( stderr, "[%u] Holding off state %d (receiver busy)\n",
+		 (unsigned int)(timestamp() % 100000), (int)inst.new_num() );
+      }
+      return;
+    }
+
     if ( received_states.size() > 1024 ) { /* limit on state queue */
       uint64_t now = timestamp();
       if ( now < receiver_quench_timer ) { /* deny letting state grow further */
@@ -61,6 +61,7 @@ namespace Network {
     /* simple receiver */
     list< TimestampedState<RemoteState> > received_states;
     uint64_t receiver_quench_timer;
+    bool holding_new_states;
     RemoteState last_receiver_state; /* the state we were in when user last queried state */
     FragmentAssembly fragments;
     bool verbose;
@@ -80,6 +81,11 @@ namespace Network {
     /* Blocks waiting for a packet. */
     void recv( void );
 
+    /* While set, new remote states are neither accepted nor acknowledged,
+       so the sender must retry them later. Acknowledgments of our own
+       states are still processed. */
+    void hold_new_states( bool hold ) { holding_new_states = hold; }
+
     /* Find diff between last receiver state and current remote state, then rationalize states. */
     string get_remote_diff( void );
 
@@ -36,6 +36,8 @@
 #include "hostinput.pb.h"
 
 #include <limits.h>
+#include <string.h>
+#include <algorithm>
 
 using namespace std;
 using namespace Parser;
@@ -44,18 +46,40 @@ using namespace HostBuffers;
 
 string Complete::act( const string &str )
 {
-  for ( unsigned int i = 0; i < str.size(); i++ ) {
-    /* parse octet into up to three actions */
-    list<Action *> actions( parser.input( str[ i ] ) );
-    
-    /* apply actions to terminal and delete them */
-    for ( list<Action *>::iterator it = actions.begin();
-	  it != actions.end();
-	  it++ ) {
-      Action *act = *it;
-      act->act_on_terminal( &terminal );
-      delete act;
+  const char *data = str.data();
+  size_t len = str.size();
+  const DrawState &ds = terminal.get_fb().ds;
+
+  /* parse octets and apply the resulting actions to the terminal */
+  if ( (size_t( count( data, data + len, '\n' ) ) < size_t( ds.get_height() ))
+       && (len < size_t( ds.get_width() ) * ds.get_height()) ) {
+    parser.input( data, len, terminal );
+    return terminal.read_octets_to_host();
+  }
+
+  /* Enough to scroll the screen: drop the plain text that would
+     scroll off unseen. Lines with anything else in them are parsed
+     whole, and plain text is looked for again at the next newline. */
+  while ( len > 0 ) {
+    size_t plain = 0;
+    if ( parser.is_idle() ) {
+      size_t skip = terminal.flood_skip( data, len, &plain );
+      data += skip;
+      len -= skip;
+      plain -= skip;
+    }
+
+    size_t n = len;
+    if ( plain < len ) {
+      const void *newline = memchr( data + plain + 1, '\n', len - plain - 1 );
+      if ( newline ) {
+	n = static_cast<const char *>( newline ) - data;
+      }
     }
+
+    parser.input( data, n, terminal );
+    data += n;
+    len -= n;
   }
 
   return terminal.read_octets_to_host();
@@ -87,7 +111,8 @@ string Complete::diff_from( const Complete &existing ) const
       new_res->MutableExtension( resize )->set_height( terminal.get_fb().ds.get_height() );
     }
     Instruction *new_inst = output.add_instruction();
-    new_inst->MutableExtension( hostbytes )->set_hoststring( display.new_frame( true, existing.get_fb(), terminal.get_fb() ) );
+    display.new_frame( true, existing.get_fb(), terminal.get_fb(),
+		       *new_inst->MutableExtension( hostbytes )->mutable_hoststring() );
   }
   
   return output.SerializeAsString();
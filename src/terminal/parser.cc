@@ -32,145 +32,131 @@
 
 #include <assert.h>
 #include <typeinfo>
-#include <errno.h>
 #include <wchar.h>
-#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "parser.h"
 
 const Parser::StateFamily Parser::family;
 
-static void append_or_delete( Parser::Action *act,
-			      std::list<Parser::Action *>&vec )
+static unsigned char action_code( Parser::Action *act )
 {
-  assert( act );
+  using namespace Parser;
 
-  if ( typeid( *act ) != typeid( Parser::Ignore ) ) {
-    vec.push_back( act );
-  } else {
-    delete act;
-  }
+  assert( act );
+  const std::type_info &t = typeid( *act );
+  unsigned char code = TransitionTable::ACTION_IGNORE;
+
+  if ( t == typeid( Print ) ) code = TransitionTable::ACTION_PRINT;
+  else if ( t == typeid( Execute ) ) code = TransitionTable::ACTION_EXECUTE;
+  else if ( t == typeid( Clear ) ) code = TransitionTable::ACTION_CLEAR;
+  else if ( t == typeid( Collect ) ) code = TransitionTable::ACTION_COLLECT;
+  else if ( t == typeid( Param ) ) code = TransitionTable::ACTION_PARAM;
+  else if ( t == typeid( Esc_Dispatch ) ) code = TransitionTable::ACTION_ESC_DISPATCH;
+  else if ( t == typeid( CSI_Dispatch ) ) code = TransitionTable::ACTION_CSI_DISPATCH;
+  else if ( t == typeid( Hook ) ) code = TransitionTable::ACTION_HOOK;
+  else if ( t == typeid( Put ) ) code = TransitionTable::ACTION_PUT;
+  else if ( t == typeid( Unhook ) ) code = TransitionTable::ACTION_UNHOOK;
+  else if ( t == typeid( OSC_Start ) ) code = TransitionTable::ACTION_OSC_START;
+  else if ( t == typeid( OSC_Put ) ) code = TransitionTable::ACTION_OSC_PUT;
+  else if ( t == typeid( OSC_End ) ) code = TransitionTable::ACTION_OSC_END;
+  else assert( t == typeid( Ignore ) );
+
+  delete act;
+  return code;
 }
 
-std::list<Parser::Action *> Parser::Parser::input( wchar_t ch )
+Parser::TransitionTable::TransitionTable()
 {
-  std::list<Action *> ret;
-
-  Transition tx = state->input( ch );
-
-  if ( tx.next_state != NULL ) {
-    append_or_delete( state->exit(), ret );
+  /* same order as StateFamily; Ground must be first */
+  const State *states[ NUM_STATES ] = {
+    &family.s_Ground, &family.s_Escape, &family.s_Escape_Intermediate,
+    &family.s_CSI_Entry, &family.s_CSI_Param, &family.s_CSI_Intermediate,
+    &family.s_CSI_Ignore, &family.s_DCS_Entry, &family.s_DCS_Param,
+    &family.s_DCS_Intermediate, &family.s_DCS_Passthrough, &family.s_DCS_Ignore,
+    &family.s_OSC_String, &family.s_SOS_PM_APC_String
+  };
+
+  for ( int s = 0; s < NUM_STATES; s++ ) {
+    enter_action[ s ] = action_code( states[ s ]->enter() );
+    exit_action[ s ] = action_code( states[ s ]->exit() );
+
+    for ( int c = 0; c < NUM_CLASSES; c++ ) {
+      wchar_t ch = ( c == CLASS_NEGATIVE ) ? -1 : c; /* any member of the class will do */
+      Transition tx = states[ s ]->input( ch );
+
+      entries[ s ][ c ].action = action_code( tx.action );
+      entries[ s ][ c ].next_state = NO_TRANSITION;
+      if ( tx.next_state ) {
+        for ( int n = 0; n < NUM_STATES; n++ ) {
+          if ( states[ n ] == tx.next_state ) {
+            entries[ s ][ c ].next_state = n;
+          }
+        }
+        assert( entries[ s ][ c ].next_state != NO_TRANSITION );
+      }
+    }
   }
+}
 
-  append_or_delete( tx.action, ret );
+const Parser::TransitionTable & Parser::TransitionTable::get( void )
+{
+  static const TransitionTable table;
+  return table;
+}
 
-  if ( tx.next_state != NULL ) {
-    append_or_delete( tx.next_state->enter(), ret );
-    state = tx.next_state;
-  }
+/* collects actions for the std::list interfaces */
+class ActionList {
+public:
+  std::list<Parser::Action *> actions;
 
-  return ret;
-}
+  template <class T>
+  void act( const T &action ) { actions.push_back( new T( action ) ); }
+};
 
-Parser::UTF8Parser::UTF8Parser()
-  : parser(), buf_len( 0 )
+std::list<Parser::Action *> Parser::Parser::input( wchar_t ch )
 {
-  assert( BUF_SIZE >= (size_t)MB_CUR_MAX );
+  ActionList ret;
+  input( ch, ret );
+  return ret.actions;
 }
 
-std::list<Parser::Action *> Parser::UTF8Parser::input( char c )
+size_t Parser::printable_ascii_run( const char *data, size_t len )
 {
-  assert( buf_len < BUF_SIZE );
-
-  buf[ buf_len++ ] = c;
-
-  /* This function will only work in a UTF-8 locale. */
-
-  wchar_t pwc;
-  mbstate_t ps;
-  memset( &ps, 0, sizeof( ps ) );
-
-  size_t total_bytes_parsed = 0;
-  size_t orig_buf_len = buf_len;
-  std::list<Action *> ret;
-
-  /* this routine is somewhat complicated in order to comply with
-     Unicode 6.0, section 3.9, "Best Practices for using U+FFFD" */
-
-  while ( total_bytes_parsed != orig_buf_len ) {
-    assert( total_bytes_parsed < orig_buf_len );
-    assert( buf_len > 0 );
-    size_t bytes_parsed = mbrtowc( &pwc, buf, buf_len, &ps );
-
-    /* this returns 0 when n = 0! */
-
-    /* This function annoying returns a size_t so we have to check
-       the negative values first before the "> 0" branch */
-
-    if ( bytes_parsed == 0 ) {
-      /* character was NUL, accept and clear buffer */
-      assert( buf_len == 1 );
-      buf_len = 0;
-      pwc = L'\0';
-      bytes_parsed = 1;
-    } else if ( bytes_parsed == (size_t) -1 ) {
-      /* invalid sequence, use replacement character and try again with last char */
-      assert( errno == EILSEQ );
-      if ( buf_len > 1 ) {
-	buf[ 0 ] = buf[ buf_len - 1 ];
-	bytes_parsed = buf_len - 1;
-	buf_len = 1;
-      } else {
-	buf_len = 0;
-	bytes_parsed = 1;
-      }
-      pwc = (wchar_t) 0xFFFD;
-    } else if ( bytes_parsed == (size_t) -2 ) {
-      /* can't parse incomplete multibyte character */
-      total_bytes_parsed += buf_len;
-      continue;
-    } else if ( bytes_parsed > 0 ) {
-      /* parsed into pwc, accept */
-      assert( bytes_parsed <= buf_len );
-      memmove( buf, buf + bytes_parsed, buf_len - bytes_parsed );
-      buf_len = buf_len - bytes_parsed;
-    } else {
-      throw std::string( "Unknown return value from mbrtowc" );
-    }
-
-    /* Cast to unsigned for checks, because some
-       platforms (e.g. ARM) use uint32_t as wchar_t,
-       causing compiler warning on "pwc > 0" check. */
-    uint64_t pwcheck = pwc;
-
-    if ( pwcheck > 0x10FFFF ) { /* outside Unicode range */
-      pwc = (wchar_t) 0xFFFD;
+  size_t i = 0;
+
+#if defined(__SSE2__)
+  /* signed compares: bytes from 0x80 up are negative and fail the first test */
+  const __m128i low = _mm_set1_epi8( 0x1F );
+  const __m128i high = _mm_set1_epi8( 0x7F );
+  for ( ; i + 16 <= len; i += 16 ) {
+    __m128i v = _mm_loadu_si128( reinterpret_cast<const __m128i *>( data + i ) );
+    __m128i ok = _mm_and_si128( _mm_cmpgt_epi8( v, low ), _mm_cmplt_epi8( v, high ) );
+    int mask = _mm_movemask_epi8( ok );
+    if ( mask != 0xFFFF ) {
+      return i + __builtin_ctz( ~mask );
     }
+  }
+#endif
 
-    if ( (pwcheck >= 0xD800) && (pwcheck <= 0xDFFF) ) { /* surrogate code point */
-      /*
-	OS X unfortunately allows these sequences without EILSEQ, but
-	they are ill-formed UTF-8 and we shouldn't repeat them to the
-	user's terminal.
-      */
-      pwc = (wchar_t) 0xFFFD;
+  for ( ; i < len; i++ ) {
+    unsigned char c = data[ i ];
+    if ( (c < 0x20) || (c > 0x7E) ) {
+      break;
     }
-
-    std::list<Action *> vec = parser.input( pwc );
-    ret.insert( ret.end(), vec.begin(), vec.end() );
-
-    total_bytes_parsed += bytes_parsed;
   }
 
-  return ret;
+  return i;
 }
 
-Parser::Parser::Parser( const Parser &other )
-  : state( other.state )
-{}
+const wchar_t Parser::UTF8Parser::REPLACEMENT;
 
-Parser::Parser & Parser::Parser::operator=( const Parser &other )
+std::list<Parser::Action *> Parser::UTF8Parser::input( char c )
 {
-  state = other.state;
-  return *this;
+  ActionList ret;
+  input( c, ret );
+  return ret.actions;
 }
@@ -39,6 +39,8 @@
 #include <wchar.h>
 #include <list>
 #include <string.h>
+#include <assert.h>
+#include <stdint.h>
 
 #include "parsertransition.h"
 #include "parseraction.h"
@@ -48,17 +50,115 @@
 namespace Parser {
   extern const StateFamily family;
 
+  /* The state machine, flattened into a table. It is filled in once,
+     at first use, by running the State classes in parserstate.cc over
+     every character class, so those classes remain the definition of
+     the parser while input() does one lookup per character and
+     allocates nothing. */
+  class TransitionTable {
+  public:
+    enum {
+      ACTION_IGNORE, ACTION_PRINT, ACTION_EXECUTE, ACTION_CLEAR,
+      ACTION_COLLECT, ACTION_PARAM, ACTION_ESC_DISPATCH,
+      ACTION_CSI_DISPATCH, ACTION_HOOK, ACTION_PUT, ACTION_UNHOOK,
+      ACTION_OSC_START, ACTION_OSC_PUT, ACTION_OSC_END
+    };
+
+    static const int NUM_STATES = 14;
+    static const unsigned char GROUND = 0;
+    static const unsigned char NO_TRANSITION = 0xFF;
+
+    /* C0 and C1 controls and GL each get a class; everything from
+       0xA0 up behaves alike, and a class for stray negative values */
+    static const int CLASS_HIGH = 0xA0;
+    static const int CLASS_NEGATIVE = 0xA1;
+    static const int NUM_CLASSES = 0xA2;
+
+    static int char_class( wchar_t ch )
+    {
+      if ( ch < 0 ) {
+        return CLASS_NEGATIVE;
+      }
+      return ( ch < CLASS_HIGH ) ? int( ch ) : CLASS_HIGH;
+    }
+
+    struct Entry {
+      unsigned char action;
+      unsigned char next_state; /* NO_TRANSITION if the state is kept */
+    };
+
+    Entry entries[ NUM_STATES ][ NUM_CLASSES ];
+    unsigned char enter_action[ NUM_STATES ];
+    unsigned char exit_action[ NUM_STATES ];
+
+    static const TransitionTable & get( void );
+
+  private:
+    TransitionTable();
+  };
+
+  /* Parser output goes to a sink, any object with a member
+       template <class T> void act( const T &action );
+     which is called with each non-Ignore action in turn. The actions
+     are temporaries; a sink that keeps them must copy them. */
+
   class Parser {
   private:
-    State const *state;
+    const TransitionTable *table;
+    unsigned char state;
+
+    template <class T, class Sink>
+    static void emit_as( bool char_present, wchar_t ch, Sink &sink )
+    {
+      T action;
+      action.char_present = char_present;
+      action.ch = ch;
+      sink.act( action );
+    }
+
+    template <class Sink>
+    static void emit( unsigned char code, bool char_present, wchar_t ch, Sink &sink )
+    {
+      switch ( code ) {
+      case TransitionTable::ACTION_IGNORE: break;
+      case TransitionTable::ACTION_PRINT: emit_as<Print>( char_present, ch, sink ); break;
+      case TransitionTable::ACTION_EXECUTE: emit_as<Execute>( char_present, ch, sink ); break;
+      case TransitionTable::ACTION_CLEAR: emit_as<Clear>( char_present, ch, sink ); break;
+      case TransitionTable::ACTION_COLLECT: emit_as<Collect>( char_present, ch, sink ); break;
+      case TransitionTable::ACTION_PARAM: emit_as<Param>( char_present, ch, sink ); break;
+      case TransitionTable::ACTION_ESC_DISPATCH: emit_as<Esc_Dispatch>( char_present, ch, sink ); break;
+      case TransitionTable::ACTION_CSI_DISPATCH: emit_as<CSI_Dispatch>( char_present, ch, sink ); break;
+      case TransitionTable::ACTION_HOOK: emit_as<Hook>( char_present, ch, sink ); break;
+      case TransitionTable::ACTION_PUT: emit_as<Put>( char_present, ch, sink ); break;
+      case TransitionTable::ACTION_UNHOOK: emit_as<Unhook>( char_present, ch, sink ); break;
+      case TransitionTable::ACTION_OSC_START: emit_as<OSC_Start>( char_present, ch, sink ); break;
+      case TransitionTable::ACTION_OSC_PUT: emit_as<OSC_Put>( char_present, ch, sink ); break;
+      case TransitionTable::ACTION_OSC_END: emit_as<OSC_End>( char_present, ch, sink ); break;
+      default: assert( false );
+      }
+    }
 
   public:
-    Parser() : state( &family.s_Ground ) {}
+    Parser() : table( &TransitionTable::get() ), state( TransitionTable::GROUND ) {}
+
+    template <class Sink>
+    void input( wchar_t ch, Sink &sink )
+    {
+      const TransitionTable::Entry &tx = table->entries[ state ][ TransitionTable::char_class( ch ) ];
+
+      if ( tx.next_state != TransitionTable::NO_TRANSITION ) {
+        emit( table->exit_action[ state ], false, -1, sink );
+      }
+
+      emit( tx.action, true, ch, sink );
 
-    Parser( const Parser &other );
-    Parser & operator=( const Parser & );
-    ~Parser() {}
+      if ( tx.next_state != TransitionTable::NO_TRANSITION ) {
+        state = tx.next_state;
+        emit( table->enter_action[ state ], false, -1, sink );
+      }
+    }
 
+    /* convenience form; the caller owns and must delete the actions */
     std::list<Action *> input( wchar_t ch );
 
     bool operator==( const Parser &x ) const
@@ -66,20 +166,132 @@ namespace Parser {
       return state == x.state;
     }
 
-    bool is_grounded( void ) const { return state == &family.s_Ground; }
+    bool is_grounded( void ) const { return state == TransitionTable::GROUND; }
   };
 
-  static const size_t BUF_SIZE = 8;
+  /* length of the leading run of printable ASCII (0x20 to 0x7E) */
+  size_t printable_ascii_run( const char *data, size_t len );
+
+  /* UTF-8 is decoded here rather than with mbrtowc(), so it no longer
+     depends on the locale and costs nothing for ASCII. Ill-formed input
+     is replaced with U+FFFD the way glibc's mbrtowc() treats it when
+     each octet is offered as in Unicode 6.0, section 3.9, "Best
+     Practices for using U+FFFD":
+
+     - the lead octet alone fixes the length (C2-DF two octets, E0-EF
+       three, F0-F7 four, F8-FB five, FC-FD six); other octets from 0x80
+       up are each replaced;
+     - a non-continuation octet cuts a sequence short: the sequence is
+       replaced and that octet starts afresh;
+     - a complete sequence that is overlong or encodes a surrogate is
+       replaced, and so (again) is its final octet;
+     - anything else beyond U+10FFFF is replaced once. */
 
   class UTF8Parser {
   private:
     Parser parser;
 
-    char buf[ BUF_SIZE ];
-    size_t buf_len;
+    uint32_t partial; /* code point bits decoded so far */
+    unsigned char length; /* octets in the current sequence */
+    unsigned char pending; /* continuation octets still to come */
+
+    static const wchar_t REPLACEMENT = 0xFFFD;
+
+    /* decode one octet outside a sequence; returns the number of
+       characters (0 or 1) written to out */
+    size_t start( unsigned char c, wchar_t *out )
+    {
+      static const unsigned char lengths[ 0x40 ] = { /* for C0 to FF */
+        0, 0, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+        2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+        3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+        4, 4, 4, 4, 4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 0, 0 };
+
+      if ( c < 0x80 ) {
+        out[ 0 ] = c;
+        return 1;
+      }
+
+      length = ( c < 0xC0 ) ? 0 : lengths[ c - 0xC0 ];
+      if ( length == 0 ) {
+        out[ 0 ] = REPLACEMENT;
+        return 1;
+      }
+
+      partial = c & (0x7F >> length);
+      pending = length - 1;
+      return 0;
+    }
 
   public:
-    UTF8Parser();
+    UTF8Parser() : parser(), partial( 0 ), length( 0 ), pending( 0 ) {}
+
+    /* decode one more octet; returns the number of characters (0, 1
+       or 2) written to out */
+    size_t decode( unsigned char c, wchar_t *out )
+    {
+      if ( pending == 0 ) {
+        return start( c, out );
+      }
+
+      if ( (c & 0xC0) != 0x80 ) {
+        pending = 0;
+        out[ 0 ] = REPLACEMENT;
+        return 1 + start( c, out + 1 );
+      }
+
+      partial = (partial << 6) | (c & 0x3F);
+      if ( --pending ) {
+        return 0;
+      }
+
+      static const uint32_t minimum[ 7 ] = { 0, 0, 0x80, 0x800, 0x10000, 0x200000, 0x4000000 };
+      if ( (partial < minimum[ length ])
+           || ((partial >= 0xD800) && (partial <= 0xDFFF)) ) {
+        out[ 0 ] = out[ 1 ] = REPLACEMENT;
+        return 2;
+      }
+
+      out[ 0 ] = ( partial > 0x10FFFF ) ? REPLACEMENT : wchar_t( partial );
+      return 1;
+    }
+
+    template <class Sink>
+    void input( char c, Sink &sink )
+    {
+      wchar_t chars[ 2 ];
+      size_t count = decode( c, chars );
+      for ( size_t i = 0; i < count; i++ ) {
+        parser.input( chars[ i ], sink );
+      }
+    }
+
+    /* Parse a buffer. In the ground state, a run of printable ASCII
+       would only produce one Print per byte, so it is passed whole to
+       sink.print_run( data, len ) instead; a sink used here must
+       provide that as well as act(). Other ASCII skips the decoder. */
+    template <class Sink>
+    void input( const char *data, size_t len, Sink &sink )
+    {
+      size_t i = 0;
+      while ( i < len ) {
+        unsigned char c = data[ i ];
+        if ( (pending == 0) && (c < 0x80) ) {
+          if ( parser.is_grounded() ) {
+            size_t run = printable_ascii_run( data + i, len - i );
+            if ( run ) {
+              sink.print_run( data + i, run );
+              i += run;
+              continue;
+            }
+          }
+          parser.input( wchar_t( c ), sink );
+          i++;
+          continue;
+        }
+        input( data[ i++ ], sink );
+      }
+    }
 
     std::list<Action *> input( char c );
 
@@ -89,6 +301,9 @@ namespace Parser {
     }
 
     bool is_grounded( void ) const { return parser.is_grounded(); }
+
+    /* grounded, and not partway through a UTF-8 sequence */
+    bool is_idle( void ) const { return (pending == 0) && parser.is_grounded(); }
   };
 }
 
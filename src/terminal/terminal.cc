@@ -35,14 +35,17 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <typeinfo>
+#include <algorithm>
 
 #include "terminal.h"
+#include "terminalwidth.h"
+#include "parser.h"
 #include "swrite.h"
 
 using namespace Terminal;
 
 Emulator::Emulator( size_t s_width, size_t s_height )
-  : fb( s_width, s_height ), dispatch(), user()
+  : fb( s_width, s_height ), dispatch(), user(), repeat_char( 0 )
 {}
 
 std::string Emulator::read_octets_to_host( void )
@@ -52,6 +55,182 @@ std::string Emulator::read_octets_to_host( void )
   return ret;
 }
 
+void Emulator::print_run( const char *s, size_t len )
+{
+  if ( len > 0 ) {
+    repeat_char = (unsigned char)s[ len - 1 ];
+  }
+
+  while ( len > 0 ) {
+    if ( fb.ds.auto_wrap_mode && fb.ds.next_print_will_wrap ) {
+      fb.get_mutable_row( -1 )->set_wrap( true );
+      fb.ds.move_col( 0 );
+      fb.move_rows_autoscroll( 1 );
+    } else if ( fb.ds.next_print_will_wrap
+                && (fb.ds.get_cursor_col() == fb.ds.get_width() - 1)
+                && (len > 1) ) {
+      /* stuck at the right margin: each character overwrites the last */
+      s += len - 1;
+      len = 1;
+    }
+
+    int col = fb.ds.get_cursor_col();
+    int count = fb.ds.get_width() - col;
+    if ( size_t( count ) > len ) {
+      count = len;
+    }
+
+    /* A cursor left outside the origin-mode margins snaps back
+       inside them (changing rows) on the first move, and a resize
+       can leave a pending wrap short of the right margin. Take those
+       one character at a time. */
+    if ( (fb.ds.get_cursor_row() < fb.ds.limit_top())
+         || (fb.ds.get_cursor_row() > fb.ds.limit_bottom())
+         || fb.ds.next_print_will_wrap ) {
+      count = 1;
+    }
+
+    if ( fb.ds.insert_mode ) {
+      fb.insert_cell( fb.ds.get_cursor_row(), col, count );
+    }
+
+    Cell blank( fb.ds.get_background_rendition() );
+    blank.renditions = fb.ds.get_renditions();
+
+    Row *row = fb.get_mutable_row( -1 );
+    for ( int i = 0; i < count; i++ ) {
+      Cell &cell = row->cells[ col + i ];
+      cell = blank;
+      cell.append( (unsigned char)s[ i ] );
+    }
+
+    /* leave the cursor and grapheme state as count single prints would */
+    if ( count > 1 ) {
+      fb.ds.move_col( count - 1, true, true );
+    }
+    fb.ds.move_col( 1, true, true );
+
+    s += count;
+    len -= count;
+  }
+}
+
+/* the part of the draw state that plain text changes */
+struct FloodCursor {
+  int row, col;
+  bool wrap;
+};
+
+/* Follows the cursor through the plain text at the start of data, as
+   print_run() and the LF, CR and HT functions would move it, counting
+   scrolls. Stops at the end of the plain text or just before the
+   octet that would make the stop'th scroll, and returns its offset. */
+static size_t flood_scan( const DrawState &ds, const char *data, size_t len,
+			  int stop, FloodCursor &c, int &scrolls )
+{
+  const int width = ds.get_width();
+  const int bottom = ds.get_scrolling_region_bottom_row();
+
+  size_t i = 0;
+  while ( i < len ) {
+    size_t run = Parser::printable_ascii_run( data + i, len - i );
+    while ( run > 0 ) {
+      if ( ds.auto_wrap_mode && c.wrap ) {
+	if ( c.row < bottom ) {
+	  c.row++;
+	} else if ( ++scrolls == stop ) {
+	  return i;
+	}
+	c.col = 0;
+      }
+
+      size_t count = run;
+      if ( ds.auto_wrap_mode && (count > size_t( width - c.col )) ) {
+	count = width - c.col;
+      }
+
+      c.wrap = (count >= size_t( width - c.col ));
+      c.col = c.wrap ? width - 1 : c.col + int( count );
+
+      i += count;
+      run -= count;
+    }
+
+    if ( i == len ) {
+      break;
+    }
+
+    switch ( data[ i ] ) {
+    case '\n':
+      if ( c.row < bottom ) {
+	c.row++;
+      } else if ( ++scrolls == stop ) {
+	return i;
+      }
+      c.wrap = false;
+      break;
+    case '\r':
+      c.col = 0;
+      c.wrap = false;
+      break;
+    case '\t':
+      c.col = ds.get_next_tab( c.col );
+      if ( c.col == -1 ) {
+	c.col = width - 1;
+      }
+      break; /* preserves the wrap state */
+    default:
+      return i;
+    }
+
+    i++;
+  }
+
+  return i;
+}
+
+size_t Emulator::flood_skip( const char *data, size_t len, size_t *plain )
+{
+  const int top = fb.ds.get_scrolling_region_top_row();
+  const int bottom = fb.ds.get_scrolling_region_bottom_row();
+  const FloodCursor start = { fb.ds.get_cursor_row(), fb.ds.get_cursor_col(),
+			      fb.ds.next_print_will_wrap };
+
+  FloodCursor c = start;
+  int scrolls = 0;
+  *plain = flood_scan( fb.ds, data, len, -1, c, scrolls );
+
+  /* the text only scrolls if the cursor starts (and so stays) in the
+     scrolling region; the margins must not snap it elsewhere */
+  if ( (start.row < top) || (start.row > bottom)
+       || (start.row < fb.ds.limit_top()) || (start.row > fb.ds.limit_bottom()) ) {
+    return 0;
+  }
+
+  /* Everything before the scroll that starts the last screenful is
+     scrolled away unseen. The rows outside the region, the renditions
+     and the tab stops are the same either way. */
+  int region = bottom - top + 1;
+  if ( scrolls < region ) {
+    return 0;
+  }
+
+  c = start;
+  int skipped_scrolls = 0;
+  size_t skip = flood_scan( fb.ds, data, *plain, scrolls - region + 1, c, skipped_scrolls );
+  if ( skip == 0 ) {
+    return 0;
+  }
+
+  /* the next octet scrolls, which starts a new grapheme, so only
+     the cursor and the wrap state need to be right */
+  fb.ds.move_row( c.row - fb.ds.get_cursor_row(), true );
+  fb.ds.move_col( c.col );
+  fb.ds.next_print_will_wrap = c.wrap;
+
+  return skip;
+}
+
 void Emulator::execute( const Parser::Execute *act )
 {
   dispatch.dispatch( CONTROL, act, &fb );
@@ -61,7 +240,7 @@ void Emulator::print( const Parser::Print *act )
 {
   assert( act->char_present );
 
-  int chwidth = act->ch == L'\0' ? -1 : wcwidth( act->ch );
+  int chwidth = act->ch == L'\0' ? -1 : char_width( act->ch );
 
   Cell *this_cell = fb.get_mutable_cell();
 
@@ -89,15 +268,13 @@ void Emulator::print( const Parser::Print *act )
     }
 
     if ( fb.ds.insert_mode ) {
-      for ( int i = 0; i < chwidth; i++ ) {
-	fb.insert_cell( fb.ds.get_cursor_row(), fb.ds.get_cursor_col() );
-      }
+      fb.insert_cell( fb.ds.get_cursor_row(), fb.ds.get_cursor_col(), chwidth );
     }
 
     this_cell = fb.get_mutable_cell();
 
     fb.reset_cell( this_cell );
-    this_cell->contents.push_back( act->ch );
+    this_cell->append( act->ch );
     this_cell->width = chwidth;
     fb.apply_renditions_to_current_cell();
 
@@ -109,6 +286,7 @@ void Emulator::print( const Parser::Print *act )
 
     fb.ds.move_col( chwidth, true, true );
 
+    repeat_char = act->ch;
     act->handled = true;
     break;
   case 0: /* combining character */
@@ -117,7 +295,7 @@ void Emulator::print( const Parser::Print *act )
       break;
     }
 
-    if ( combining_cell->contents.size() == 0 ) {
+    if ( combining_cell->empty() ) {
       /* cell starts with combining character */
       assert( this_cell == combining_cell );
       assert( combining_cell->width == 1 );
@@ -125,9 +303,8 @@ void Emulator::print( const Parser::Print *act )
       fb.ds.move_col( 1, true, true );
     }
 
-    if ( combining_cell->contents.size() < 16 ) {
-      /* seems like a reasonable limit on combining characters */
-      combining_cell->contents.push_back( act->ch );
+    if ( !combining_cell->full() ) {
+      combining_cell->append( act->ch );
     }
     act->handled = true;
     break;
@@ -141,6 +318,42 @@ void Emulator::print( const Parser::Print *act )
 
 void Emulator::CSI_dispatch( const Parser::CSI_Dispatch *act )
 {
+  /* REP prints, so it is handled here rather than by a Function */
+  if ( (act->ch == L'b') && dispatch.get_dispatch_chars().empty() ) {
+    act->handled = true;
+    if ( repeat_char == 0 ) {
+      return;
+    }
+
+    int count = dispatch.getparam( 0, 1 ); /* at most PARAM_MAX */
+
+    /* With autowrap, each row's worth of repeats past the first
+       screenful or two scrolls in (or, below the scrolling region,
+       rewrites) one more identical row, so only the remainder
+       matters. */
+    const int width = fb.ds.get_width();
+    const int per_row = std::max( (char_width( repeat_char ) == 2) ? width / 2 : width, 1 );
+    const int keep = (2 * fb.ds.get_height() + 2) * per_row;
+    if ( fb.ds.auto_wrap_mode && (count > keep) ) {
+      count = keep + (count - keep) % per_row;
+    }
+
+    Parser::Print repeat;
+    repeat.char_present = true;
+    repeat.ch = repeat_char;
+    for ( int i = 0; i < count; i++ ) {
+      /* without autowrap, a print stuck at the right margin leaves
+	 nothing for the ones after it to change */
+      bool stuck = (!fb.ds.auto_wrap_mode) && fb.ds.next_print_will_wrap
+	&& (fb.ds.get_cursor_col() == width - 1);
+      print( &repeat );
+      if ( stuck ) {
+	break;
+      }
+    }
+    return;
+  }
+
   dispatch.dispatch( CSI, act, &fb );
 }
 
@@ -65,6 +65,8 @@ namespace Terminal {
     Dispatcher dispatch;
     UserInput user;
 
+    wchar_t repeat_char; /* last graphic character printed, for REP */
+
     /* action methods */
     void print( const Parser::Print *act );
     void execute( const Parser::Execute *act );
@@ -78,6 +80,21 @@ namespace Terminal {
 
     std::string read_octets_to_host( void );
 
+    /* sink for Parser::input(): apply each action as it is parsed */
+    template <class T>
+    void act( const T &action ) { action.act_on_terminal( this ); }
+
+    /* same effect as a Print for each character; printable ASCII only */
+    void print_run( const char *s, size_t len );
+
+    /* Plain text (printable ASCII, CR, LF and HT) that scrolls the
+       whole scrolling region away within data need not be drawn.
+       Returns how many octets at the start of data can be dropped,
+       having moved the cursor to where drawing them would have left
+       it, and sets *plain to the length of the plain text. The parser
+       must be idle. */
+    size_t flood_skip( const char *data, size_t len, size_t *plain );
+
     const Framebuffer & get_fb( void ) const { return fb; }
 
     bool operator==( Emulator const &x ) const;
@@ -0,0 +1,160 @@
+/*
+    Mosh: the mobile shell
+    Copyright 2012 Keith Winstein
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations including
+    the two.
+
+    You must obey the GNU General Public License in all respects for all
+    of the code used other than OpenSSL. If you modify file(s) with this
+    exception, you may extend this exception to your version of the
+    file(s), but you are not obligated to do so. If you do not wish to do
+    so, delete this exception statement from your version. If you delete
+    this exception statement from all source files in the program, then
+    also delete it here.
+*/
+
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <vector>
+
+#include "terminalarena.h"
+
+using namespace Terminal;
+
+/* Blocks are rounded up to a multiple of ALIGNMENT. Sizes up to
+   MAX_POOLED come from slabs; larger ones (very wide rows) go straight
+   to the system. */
+static const size_t MAX_POOLED = 16384;
+static const size_t SLAB_SIZE = 262144;
+
+static void *aligned_alloc_or_throw( size_t bytes )
+{
+  void *p = NULL;
+#if defined(HAVE_POSIX_MEMALIGN)
+  if ( ( 0 != posix_memalign( &p, Arena::ALIGNMENT, bytes ) )
+       || ( p == NULL ) ) {
+    throw std::bad_alloc();
+  }
+#else
+  /* over-allocate and align by hand, stashing the real pointer
+     just below the block */
+  void *raw = malloc( bytes + Arena::ALIGNMENT + sizeof( void * ) );
+  if ( raw == NULL ) {
+    throw std::bad_alloc();
+  }
+  uintptr_t iptr = (uintptr_t) raw + sizeof( void * );
+  iptr = ( iptr + Arena::ALIGNMENT - 1 ) & ~uintptr_t( Arena::ALIGNMENT - 1 );
+  p = (void *) iptr;
+  ((void **) p)[ -1 ] = raw;
+#endif
+  return p;
+}
+
+static void aligned_free( void *p )
+{
+#if defined(HAVE_POSIX_MEMALIGN)
+  free( p );
+#else
+  free( ((void **) p)[ -1 ] );
+#endif
+}
+
+class SlabPool {
+private:
+  struct FreeBlock {
+    FreeBlock *next;
+  };
+
+  std::vector<FreeBlock *> free_lists; /* indexed by size class */
+  char *slab_next;
+  size_t slab_remaining;
+
+public:
+  SlabPool() : free_lists( MAX_POOLED / Arena::ALIGNMENT + 1, (FreeBlock *)NULL ),
+               slab_next( NULL ), slab_remaining( 0 ) {}
+
+  void *allocate( size_t rounded )
+  {
+    FreeBlock *&head = free_lists[ rounded / Arena::ALIGNMENT ];
+    if ( head ) {
+      FreeBlock *block = head;
+      head = block->next;
+      return block;
+    }
+
+    if ( slab_remaining < rounded ) {
+      /* the tail of the old slab is abandoned; it is at most MAX_POOLED */
+      slab_next = static_cast<char *>( aligned_alloc_or_throw( SLAB_SIZE ) );
+      slab_remaining = SLAB_SIZE;
+    }
+
+    void *ret = slab_next;
+    slab_next += rounded;
+    slab_remaining -= rounded;
+    return ret;
+  }
+
+  void release( void *p, size_t rounded )
+  {
+    FreeBlock *block = static_cast<FreeBlock *>( p );
+    FreeBlock *&head = free_lists[ rounded / Arena::ALIGNMENT ];
+    block->next = head;
+    head = block;
+  }
+};
+
+static SlabPool & get_pool( void )
+{
+  static SlabPool pool;
+  return pool;
+}
+
+static size_t round_up( size_t bytes )
+{
+  if ( bytes == 0 ) {
+    bytes = 1;
+  }
+  return ( bytes + Arena::ALIGNMENT - 1 ) & ~( Arena::ALIGNMENT - 1 );
+}
+
+void *Arena::allocate( size_t bytes )
+{
+  size_t rounded = round_up( bytes );
+  if ( rounded > MAX_POOLED ) {
+    return aligned_alloc_or_throw( rounded );
+  }
+  return get_pool().allocate( rounded );
+}
+
+void Arena::release( void *p, size_t bytes )
+{
+  if ( p == NULL ) {
+    return;
+  }
+  size_t rounded = round_up( bytes );
+  if ( rounded > MAX_POOLED ) {
+    aligned_free( p );
+    return;
+  }
+  get_pool().release( p, rounded );
+}
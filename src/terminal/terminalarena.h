@@ -0,0 +1,96 @@
+/*
+    Mosh: the mobile shell
+    Copyright 2012 Keith Winstein
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations including
+    the two.
+
+    You must obey the GNU General Public License in all respects for all
+    of the code used other than OpenSSL. If you modify file(s) with this
+    exception, you may extend this exception to your version of the
+    file(s), but you are not obligated to do so. If you do not wish to do
+    so, delete this exception statement from your version. If you delete
+    this exception statement from all source files in the program, then
+    also delete it here.
+*/
+
+
+#ifndef TERMINALARENA_HPP
+#define TERMINALARENA_HPP
+
+#include <stddef.h>
+#include <new>
+
+/* Slab allocator for framebuffer rows and cells.
+
+   Rows are created and dropped constantly (every scroll, every
+   copy-on-write detach), almost always in a handful of sizes fixed by
+   the screen width. Blocks are carved from large cache-aligned slabs
+   and returned to per-size free lists, so a session settles into a
+   few slab allocations and rows allocated together sit next to each
+   other in memory. Memory is reused but never returned to the system.
+   Not thread-safe, like the rest of the terminal state. */
+
+namespace Terminal {
+  class Arena {
+  public:
+    static const size_t ALIGNMENT = 64;
+
+    static void *allocate( size_t bytes );
+    static void release( void *p, size_t bytes );
+  };
+
+  /* STL allocator drawing from Arena */
+  template <class T>
+  class ArenaAllocator {
+  public:
+    typedef T value_type;
+    typedef T *pointer;
+    typedef const T *const_pointer;
+    typedef T &reference;
+    typedef const T &const_reference;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+
+    template <class U> struct rebind { typedef ArenaAllocator<U> other; };
+
+    ArenaAllocator() {}
+    template <class U> ArenaAllocator( const ArenaAllocator<U> & ) {}
+
+    pointer address( reference x ) const { return &x; }
+    const_pointer address( const_reference x ) const { return &x; }
+
+    pointer allocate( size_type n, const void * = 0 )
+    {
+      return static_cast<pointer>( Arena::allocate( n * sizeof( T ) ) );
+    }
+
+    void deallocate( pointer p, size_type n ) { Arena::release( p, n * sizeof( T ) ); }
+
+    size_type max_size( void ) const { return size_t( -1 ) / sizeof( T ); }
+
+    void construct( pointer p, const T &val ) { new( static_cast<void *>( p ) ) T( val ); }
+    void destroy( pointer p ) { p->~T(); }
+
+    bool operator==( const ArenaAllocator & ) const { return true; }
+    bool operator!=( const ArenaAllocator & ) const { return false; }
+  };
+}
+
+#endif
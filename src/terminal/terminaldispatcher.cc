@@ -33,8 +33,8 @@
 #include <stdio.h>
 #include <assert.h>
 #include <string.h>
-#include <errno.h>
 #include <stdlib.h>
+#include <algorithm>
 
 #include "terminaldispatcher.h"
 #include "parseraction.h"
@@ -43,20 +43,29 @@
 using namespace Terminal;
 
 Dispatcher::Dispatcher()
-  : params(), parsed_params(), parsed( false ), dispatch_chars(),
+  : params_count( 1 ), param_chars( 0 ), dispatch_chars(),
     OSC_string(), terminal_to_host()
-{}
+{
+  params[ 0 ] = -1;
+}
 
 void Dispatcher::newparamchar( const Parser::Param *act )
 {
   assert( act->char_present );
   assert( (act->ch == ';') || ( (act->ch >= '0') && (act->ch <= '9') ) );
-  if ( params.length() < 100 ) {
-    /* enough for 16 five-char params plus 15 semicolons */
-    params.push_back( act->ch );
+  if ( param_chars < PARAM_CHARS_MAX ) {
+    param_chars++;
+    int &param = params[ params_count - 1 ];
+    if ( act->ch == ';' ) {
+      params[ params_count++ ] = -1;
+    } else if ( param < 0 ) {
+      param = act->ch - '0';
+    } else if ( param <= PARAM_MAX ) {
+      /* stops growing once too big */
+      param = param * 10 + (act->ch - '0');
+    }
     act->handled = true;
   }
-  parsed = false;
 }
 
 void Dispatcher::collect( const Parser::Collect *act )
@@ -71,121 +80,74 @@ void Dispatcher::collect( const Parser::Collect *act )
 
 void Dispatcher::clear( const Parser::Clear *act )
 {
-  params.clear();
+  params_count = 1;
+  params[ 0 ] = -1;
+  param_chars = 0;
   dispatch_chars.clear();
-  parsed = false;
   act->handled = true;
 }
 
-void Dispatcher::parse_params( void )
+std::string Dispatcher::str( void )
 {
-  if ( parsed ) {
-    return;
-  }
-
-  parsed_params.clear();
-  const char *str = params.c_str();
-  const char *segment_begin = str;
-
-  while ( 1 ) {
-    const char *segment_end = strchr( segment_begin, ';' );
-    if ( segment_end == NULL ) {
-      break;
-    }
-
-    errno = 0;
-    char *endptr;
-    long val = strtol( segment_begin, &endptr, 10 );
-    if ( endptr == segment_begin ) {
-      val = -1;
-    }
-
-    if ( val > PARAM_MAX || errno == ERANGE ) {
-      val = -1;
-      errno = 0;
-    }
-
-    if ( errno == 0 || segment_begin == endptr ) {
-      parsed_params.push_back( val );
+  std::string param_str;
+  for ( int i = 0; i < params_count; i++ ) {
+    char num[ 16 ] = "";
+    if ( params[ i ] >= 0 ) {
+      snprintf( num, 16, "%d", params[ i ] );
     }
-
-    segment_begin = segment_end + 1;
-  }
-
-  /* get last param */
-  errno = 0;
-  char *endptr;
-  long val = strtol( segment_begin, &endptr, 10 );
-  if ( endptr == segment_begin ) {
-    val = -1;
+    param_str += ( i ? ";" : "" );
+    param_str += num;
   }
 
-  if ( val > PARAM_MAX || errno == ERANGE ) {
-    val = -1;
-    errno = 0;
-  }
-
-  if ( errno == 0 || segment_begin == endptr ) {
-    parsed_params.push_back( val );
-  }
+  char assum[ 64 ];
+  snprintf( assum, 64, "[dispatch=\"%s\" params=\"%s\"]",
+	    dispatch_chars.c_str(), param_str.c_str() );
+  return std::string( assum );
+}
 
-  parsed = true;
+/* construct on first use to avoid static initialization order crash */
+DispatchRegistry & Terminal::get_global_dispatch_registry( void )
+{
+  static DispatchRegistry global_dispatch_registry;
+  return global_dispatch_registry;
 }
 
-int Dispatcher::getparam( size_t N, int defaultval )
+Function *DispatchRegistry::slot( Function_Type type, const char *dispatch_chars, size_t len )
 {
-  int ret = defaultval;
-  if ( !parsed ) {
-    parse_params();
+  if ( len == 0 ) {
+    return NULL;
   }
 
-  if ( parsed_params.size() > N ) {
-    ret = parsed_params[ N ];
+  unsigned char final = dispatch_chars[ len - 1 ];
+  if ( type == CONTROL ) {
+    return ( len == 1 ) ? &control[ final ] : NULL;
   }
 
-  if ( ret < 1 ) ret = defaultval;
-
-  return ret;
-}
-
-int Dispatcher::param_count( void )
-{
-  if ( !parsed ) {
-    parse_params();
+  if ( (final < 0x20) || (final > 0x7F) || (len > 2) ) {
+    return NULL;
   }
 
-  return parsed_params.size();
-}
-
-std::string Dispatcher::str( void )
-{
-  char assum[ 64 ];
-  snprintf( assum, 64, "[dispatch=\"%s\" params=\"%s\"]",
-	    dispatch_chars.c_str(), params.c_str() );
-  return std::string( assum );
-}
+  int prefix = 0;
+  if ( len == 2 ) {
+    unsigned char c = dispatch_chars[ 0 ];
+    if ( (c < 0x20) || (c > 0x3F) ) {
+      return NULL;
+    }
+    prefix = c - 0x20 + 1;
+  }
 
-/* construct on first use to avoid static initialization order crash */
-DispatchRegistry & Terminal::get_global_dispatch_registry( void )
-{
-  static DispatchRegistry global_dispatch_registry;
-  return global_dispatch_registry;
+  Function (*table)[ NUM_FINALS ] = ( type == ESCAPE ) ? escape : CSI;
+  return &table[ prefix ][ final - 0x20 ];
 }
 
 static void register_function( Function_Type type,
 			       std::string dispatch_chars,
 			       Function f )
 {
-  switch ( type ) {
-  case ESCAPE:
-    get_global_dispatch_registry().escape.insert( dispatch_map_t::value_type( dispatch_chars, f ) );
-    break;
-  case CSI:
-    get_global_dispatch_registry().CSI.insert( dispatch_map_t::value_type( dispatch_chars, f ) );
-    break;
-  case CONTROL:
-    get_global_dispatch_registry().control.insert( dispatch_map_t::value_type( dispatch_chars, f ) );
-    break;
+  Function *slot = get_global_dispatch_registry().slot( type, dispatch_chars.data(), dispatch_chars.size() );
+  assert( slot ); /* the registry has no room for this key */
+  if ( slot->function == NULL ) {
+    *slot = f;
   }
 }
 
@@ -208,31 +170,26 @@ void Dispatcher::dispatch( Function_Type type, const Parser::Action *act, Frameb
     collect( &act2 ); 
   }
 
-  dispatch_map_t *map = NULL;
-  switch ( type ) {
-  case ESCAPE:  map = &get_global_dispatch_registry().escape;  break;
-  case CSI:     map = &get_global_dispatch_registry().CSI;     break;
-  case CONTROL: map = &get_global_dispatch_registry().control; break;
-  }
-
-  std::string key = dispatch_chars;
+  const Function *f;
   if ( type == CONTROL ) {
     assert( act->ch <= 255 );
-    char ctrlstr[ 2 ] = { (char)act->ch, 0 };
-    key = std::string( ctrlstr, 1 );
+    f = &get_global_dispatch_registry().control[ act->ch ];
+  } else if ( (act->ch > 255) || (dispatch_chars.size() > 2) ) {
+    f = NULL; /* final char not collected, or too many intermediates */
+  } else {
+    f = get_global_dispatch_registry().slot( type, dispatch_chars.data(), dispatch_chars.size() );
   }
 
-  dispatch_map_t::const_iterator i = map->find( key );
-  if ( i == map->end() ) {
+  if ( (f == NULL) || (f->function == NULL) ) {
     /* unknown function */
     fb->ds.next_print_will_wrap = false;
     return;
   } else {
     act->handled = true;
-    if ( i->second.clears_wrap_state ) {
+    if ( f->clears_wrap_state ) {
       fb->ds.next_print_will_wrap = false;
     }
-    return i->second.function( fb, this );
+    return f->function( fb, this );
   }
 }
 
@@ -253,6 +210,7 @@ void Dispatcher::OSC_start( const Parser::OSC_Start *act )
 
 bool Dispatcher::operator==( const Dispatcher &x ) const
 {
-  return ( params == x.params ) && ( parsed_params == x.parsed_params ) && ( parsed == x.parsed )
+  return ( params_count == x.params_count ) && std::equal( params, params + params_count, x.params )
+    && ( param_chars == x.param_chars )
     && ( dispatch_chars == x.dispatch_chars ) && ( OSC_string == x.OSC_string ) && ( terminal_to_host == x.terminal_to_host );
 }
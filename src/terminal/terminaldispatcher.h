@@ -35,7 +35,6 @@
 
 #include <vector>
 #include <string>
-#include <map>
 
 namespace Parser {
   class Action;
@@ -66,39 +65,61 @@ namespace Terminal {
     bool clears_wrap_state;
   };
 
-  typedef std::map<std::string, Function> dispatch_map_t;
-
+  /* Functions are found by direct indexing: controls by their code,
+     escape and CSI functions by their final byte and by the single
+     intermediate or private-marker byte (0x20 to 0x3F) that may
+     precede it. No function uses more than one. */
   class DispatchRegistry {
   public:
-    dispatch_map_t escape;
-    dispatch_map_t CSI;
-    dispatch_map_t control;
+    static const int NUM_PREFIXES = 0x21; /* none, or 0x20 to 0x3F */
+    static const int NUM_FINALS = 0x60; /* 0x20 to 0x7F */
+
+    Function escape[ NUM_PREFIXES ][ NUM_FINALS ];
+    Function CSI[ NUM_PREFIXES ][ NUM_FINALS ];
+    Function control[ 0x100 ];
 
-    DispatchRegistry() : escape(), CSI(), control() {}
+    DispatchRegistry() {}
+
+    /* where the function for these dispatch characters belongs, or
+       NULL if there can be no such function */
+    Function *slot( Function_Type type, const char *dispatch_chars, size_t len );
   };
 
   DispatchRegistry & get_global_dispatch_registry( void );
 
   class Dispatcher {
+  public:
+    static const int PARAM_MAX = 65535;
+    /* prevent evil escape sequences from causing long loops */
+
   private:
-    std::string params;
-    std::vector<int> parsed_params;
-    bool parsed;
+    /* Parameters are converted as their characters arrive, so
+       functions read them without any parsing. Only the first
+       PARAM_CHARS_MAX characters count, which is enough for 16
+       five-char params plus 15 semicolons. */
+    static const size_t PARAM_CHARS_MAX = 100;
+    static const int PARAMS_MAX = PARAM_CHARS_MAX + 1;
+
+    int params[ PARAMS_MAX ]; /* -1 if empty, above PARAM_MAX if too big */
+    int params_count;
+    size_t param_chars;
 
     std::string dispatch_chars;
     std::vector<wchar_t> OSC_string; /* only used to set the window title */
 
-    void parse_params( void );
-
   public:
-    static const int PARAM_MAX = 65535;
-    /* prevent evil escape sequences from causing long loops */
-
     std::string terminal_to_host; /* this is the reply string */
 
     Dispatcher();
-    int getparam( size_t N, int defaultval );
-    int param_count( void );
+
+    int getparam( size_t N, int defaultval ) const
+    {
+      int ret = ( N < size_t( params_count ) ) ? params[ N ] : defaultval;
+      if ( (ret < 1) || (ret > PARAM_MAX) ) ret = defaultval;
+      return ret;
+    }
+
+    int param_count( void ) const { return params_count; }
 
     void newparamchar( const Parser::Param *act );
     void collect( const Parser::Collect *act );
@@ -107,7 +128,7 @@ namespace Terminal {
     std::string str( void );
 
     void dispatch( Function_Type type, const Parser::Action *act, Framebuffer *fb );
-    std::string get_dispatch_chars( void ) const { return dispatch_chars; }
+    const std::string & get_dispatch_chars( void ) const { return dispatch_chars; }
     std::vector<wchar_t> get_OSC_string( void ) const { return OSC_string; }
 
     void OSC_put( const Parser::OSC_Put *act );
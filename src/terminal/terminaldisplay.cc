@@ -30,7 +30,10 @@
     also delete it here.
 */
 
-#include <stdio.h>
+
+#include <limits.h>
+#include <algorithm>
+#include <vector>
 
 #include "terminaldisplay.h"
 
@@ -44,6 +47,32 @@ static const Renditions & initial_rendition( void )
   return blank;
 }
 
+static int decimal_length( int n )
+{
+  int len = 1;
+  while ( n >= 10 ) {
+    n /= 10;
+    len++;
+  }
+  return len;
+}
+
+/* length of ESC [ n final, where a count of 1 is left out */
+static int csi_count_length( int n )
+{
+  return ( n == 1 ) ? 3 : 3 + decimal_length( n );
+}
+
+static void append_csi_count( FrameState &frame, int n, char final )
+{
+  if ( n == 1 ) {
+    frame.append( "\033[" );
+    frame.append( final );
+  } else {
+    frame.append_csi( n, final );
+  }
+}
+
 std::string Display::open() const
 {
   return std::string( smcup ? smcup : "" ) + std::string( "\033[?1h" );
@@ -56,9 +85,14 @@ std::string Display::close() const
 
 std::string Display::new_frame( bool initialized, const Framebuffer &last, const Framebuffer &f ) const
 {
-  FrameState frame( last );
+  std::string out;
+  new_frame( initialized, last, f, out );
+  return out;
+}
 
-  char tmp[ 64 ];
+void Display::new_frame( bool initialized, const Framebuffer &last, const Framebuffer &f, std::string &out ) const
+{
+  FrameState frame( last, out );
 
   /* has bell been rung? */
   if ( f.get_bell_count() != frame.last_frame.get_bell_count() ) {
@@ -78,8 +112,7 @@ std::string Display::new_frame( bool initialized, const Framebuffer &last, const
       for ( std::deque<wchar_t>::const_iterator i = window_title.begin();
             i != window_title.end();
             i++ ) {
-	snprintf( tmp, 64, "%lc", *i );
-	frame.append( tmp );
+	frame.append_char( *i );
       }
       frame.append( "\007" );
       /* ST is more correct, but BEL more widely supported */
@@ -88,20 +121,18 @@ std::string Display::new_frame( bool initialized, const Framebuffer &last, const
       frame.append( "\033]1;" );
       const std::deque<wchar_t> &icon_name( f.get_icon_name() );
       for ( std::deque<wchar_t>::const_iterator i = icon_name.begin();
-	    i != icon_name.end();
-	    i++ ) {
-	snprintf( tmp, 64, "%lc", *i );
-	frame.append( tmp );
+            i != icon_name.end();
+            i++ ) {
+	frame.append_char( *i );
       }
       frame.append( "\007" );
 
       frame.append( "\033]2;" );
       const std::deque<wchar_t> &window_title( f.get_window_title() );
       for ( std::deque<wchar_t>::const_iterator i = window_title.begin();
-	    i != window_title.end();
-	    i++ ) {
-	snprintf( tmp, 64, "%lc", *i );
-	frame.append( tmp );
+            i != window_title.end();
+            i++ ) {
+	frame.append_char( *i );
       }
       frame.append( "\007" );
     }
@@ -112,8 +143,7 @@ std::string Display::new_frame( bool initialized, const Framebuffer &last, const
   if ( (!initialized)
        || (f.ds.reverse_video != frame.last_frame.ds.reverse_video) ) {
     /* set reverse video */
-    snprintf( tmp, 64, "\033[?5%c", (f.ds.reverse_video ? 'h' : 'l') );
-    frame.append( tmp );
+    frame.append( f.ds.reverse_video ? "\033[?5h" : "\033[?5l" );
   }
 
   /* has size changed? */
@@ -121,9 +151,7 @@ std::string Display::new_frame( bool initialized, const Framebuffer &last, const
        || (f.ds.get_width() != frame.last_frame.ds.get_width())
        || (f.ds.get_height() != frame.last_frame.ds.get_height()) ) {
     /* reset scrolling region */
-    snprintf( tmp, 64, "\033[%d;%dr",
-	      1, f.ds.get_height() );
-    frame.append( tmp );
+    frame.append_csi( 1, f.ds.get_height(), 'r' );
 
     /* clear screen */
     frame.append( "\033[0m\033[H\033[2J" );
@@ -133,89 +161,61 @@ std::string Display::new_frame( bool initialized, const Framebuffer &last, const
   } else {
     frame.cursor_x = frame.last_frame.ds.get_cursor_col();
     frame.cursor_y = frame.last_frame.ds.get_cursor_row();
+    if ( frame.last_frame.ds.next_print_will_wrap ) {
+      frame.cursor_x = f.ds.get_width();
+    }
     frame.current_rendition = frame.last_frame.ds.get_renditions();
   }
 
-  /* shortcut -- has display moved up by a certain number of lines? */
-  frame.y = 0;
-
+  /* shortcut -- have lines moved up or down, in all or part of the
+     display? Scroll them into place instead of drawing them again. */
   if ( initialized ) {
-    int lines_scrolled = 0;
-    int scroll_height = 0;
-
-    for ( int row = 0; row < f.ds.get_height(); row++ ) {
-      if ( *(f.get_row( 0 )) == *(frame.last_frame.get_row( row )) ) {
-	/* found a scroll */
-	lines_scrolled = row;
-	scroll_height = 1;
-
-	/* how big is the region that was scrolled? */
-	for ( int region_height = 1;
-	      lines_scrolled + region_height < f.ds.get_height();
-	      region_height++ ) {
-	  if ( *(f.get_row( region_height ))
-	       == *(frame.last_frame.get_row( lines_scrolled + region_height )) ) {
-	    scroll_height = region_height + 1;
-	  } else {
-	    break;
-	  }
-	}
-
-	break;
-      }
-    }
-
-    if ( scroll_height ) {
-      frame.y = scroll_height;
-
-      if ( lines_scrolled ) {
-	if ( !(frame.current_rendition == initial_rendition()) ) {
-	  frame.append( "\033[0m" );
-	  frame.current_rendition = initial_rendition();
-	}
-
-	int top_margin = 0;
-	int bottom_margin = top_margin + lines_scrolled + scroll_height - 1;
-
-	assert( bottom_margin < f.ds.get_height() );
-
-	/* set scrolling region */
-	snprintf( tmp, 64, "\033[%d;%dr",
-		  top_margin + 1, bottom_margin + 1);
-	frame.append( tmp );
-
-	/* go to bottom of scrolling region */
-	frame.append_silent_move( bottom_margin, 0 );
-
-	/* scroll */
-	for ( int i = 0; i < lines_scrolled; i++ ) {
-	  frame.append( "\n" );
-	}
+    append_scrolls( frame, f );
+  }
 
-	/* do the move in memory */
-	for ( int i = top_margin; i <= bottom_margin; i++ ) {
-	  if ( i + lines_scrolled <= bottom_margin ) {
-	    *(frame.last_frame.get_mutable_row( i )) = *(frame.last_frame.get_row( i + lines_scrolled ));
-	  } else {
-	    frame.last_frame.get_mutable_row( i )->reset( 0 );
-	  }
-	}
+  frame.y = 0;
 
-	/* reset scrolling region */
-	snprintf( tmp, 64, "\033[%d;%dr",
-		  1, f.ds.get_height() );
-	frame.append( tmp );
+  /* iterate for every cell */
+  for ( ; frame.y < f.ds.get_height(); frame.y++ ) {
+    /* skip rows that have not been modified since the last frame
+       (and wrapped rows whose next row has not been modified either,
+       since the terminal still has the wrap hint) */
+    const bool hinted = initialized
+      && ( (!f.get_row( frame.y )->get_wrap())
+	   || ( (frame.y < f.ds.get_height() - 1)
+		&& (*(f.get_row( frame.y + 1 )) == *(frame.get_last_row( frame.y + 1 ))) ) );
+    if ( initialized
+         && !frame.force_next_put
+         && hinted
+         && (f.get_row( frame.y )->gen == frame.get_last_row( frame.y )->gen) ) {
+      continue;
+    }
 
-	/* invalidate cursor position after unsetting scrolling region */
-	frame.cursor_x = frame.cursor_y = -1;
+    int last_x = 0;
+    frame.x = 0;
+
+    if ( initialized && !frame.force_next_put ) {
+      const Row *row = f.get_row( frame.y );
+      int first_change = cells_first_difference( &row->cells.front(),
+                                                 &frame.get_last_row( frame.y )->cells.front(),
+                                                 f.ds.get_width() );
+      if ( first_change == f.ds.get_width() ) {
+        if ( hinted ) {
+          continue;
+        }
+        /* only the wrap hint is missing: start at the last cell */
+        while ( frame.x + row->cells[ frame.x ].width < f.ds.get_width() ) {
+          frame.x += row->cells[ frame.x ].width;
+        }
+      } else {
+        /* start at the cell boundary covering the first change */
+        while ( frame.x + row->cells[ frame.x ].width <= first_change ) {
+          frame.x += row->cells[ frame.x ].width;
+        }
       }
     }
-  }
 
-  /* iterate for every cell */
-  for ( ; frame.y < f.ds.get_height(); frame.y++ ) {
-    int last_x = 0;
-    for ( frame.x = 0;
+    for ( ;
 	  frame.x < f.ds.get_width(); /* let put_cell() handle advance */ ) {
       last_x = frame.x;
       put_cell( initialized, frame, f );
@@ -235,23 +235,24 @@ std::string Display::new_frame( bool initialized, const Framebuffer &last, const
       }
 
       /* next write will wrap */
-      frame.cursor_x = 0;
-      frame.cursor_y++;
+      if ( frame.cursor_x == f.ds.get_width() ) {
+	frame.cursor_x = 0;
+	frame.cursor_y++;
+	frame.cursor_wrap_pending = true;
+      }
       frame.force_next_put = true;
     }
 
     /* Turn off wrap */
     if ( (frame.y < f.ds.get_height() - 1)
 	 && (!f.get_row( frame.y )->get_wrap())
-	 && (!initialized || frame.last_frame.get_row( frame.y )->get_wrap()) ) {
+	 && (!initialized || frame.get_last_row( frame.y )->get_wrap()) ) {
       frame.x = last_x;
-      if ( initialized ) {
-	frame.last_frame.reset_cell( frame.last_frame.get_mutable_cell( frame.y, frame.x ) );
-      }
-
-      snprintf( tmp, 64, "\033[%d;%dH\033[K", frame.y + 1, frame.x + 1 );
-      frame.append( tmp );
+      frame.append_csi( frame.y + 1, frame.x + 1, 'H' );
+      frame.append( "\033[K" );
       frame.cursor_x = frame.x;
+      frame.cursor_y = frame.y;
+      frame.cursor_wrap_pending = false;
 
       frame.force_next_put = true;
       put_cell( initialized, frame, f );
@@ -262,16 +263,15 @@ std::string Display::new_frame( bool initialized, const Framebuffer &last, const
   if ( (!initialized)
        || (f.ds.get_cursor_row() != frame.cursor_y)
        || (f.ds.get_cursor_col() != frame.cursor_x) ) {
-    snprintf( tmp, 64, "\033[%d;%dH", f.ds.get_cursor_row() + 1,
-	      f.ds.get_cursor_col() + 1 );
-    frame.append( tmp );
+    frame.append_csi( f.ds.get_cursor_row() + 1, f.ds.get_cursor_col() + 1, 'H' );
     frame.cursor_x = f.ds.get_cursor_col();
     frame.cursor_y = f.ds.get_cursor_row();
+    frame.cursor_wrap_pending = false;
   }
 
   /* has cursor visibility changed? */
   if ( (!initialized)
-       || (f.ds.cursor_visible != frame.last_frame.ds.cursor_visible) ) {
+       || (f.ds.cursor_visible != frame.cursor_visible) ) {
     if ( f.ds.cursor_visible ) {
       frame.append( "\033[?25h" );
     } else {
@@ -280,10 +280,11 @@ std::string Display::new_frame( bool initialized, const Framebuffer &last, const
   }
 
   /* have renditions changed? */
-  if ( (!initialized)
-       || !(f.ds.get_renditions() == frame.current_rendition) ) {
-    frame.appendstring( f.ds.get_renditions().sgr() );
+  if ( !initialized ) {
+    f.ds.get_renditions().sgr( frame.str );
     frame.current_rendition = f.ds.get_renditions();
+  } else {
+    append_rendition( frame, f.ds.get_renditions() );
   }
 
   /* has bracketed paste mode changed? */
@@ -314,41 +315,56 @@ std::string Display::new_frame( bool initialized, const Framebuffer &last, const
        || (f.ds.xterm_utf8_mouse != frame.last_frame.ds.xterm_utf8_mouse) ) {
     frame.append( f.ds.xterm_utf8_mouse ? "\033[?1005h" : "\033[?1005l" );
   }
+}
+
+/* Change the terminal's renditions to r, if they are not r already.
+   Prompts and highlighted text change renditions every few cells,
+   mostly between the same few, so the changes are kept. */
+void Display::append_rendition( FrameState &frame, const Renditions &r ) const
+{
+  if ( frame.current_rendition == r ) {
+    return;
+  }
+
+  uint64_t key = ( frame.current_rendition.hash() * 0x9E3779B97F4A7C15ULL ) ^ r.hash();
+  RenditionChange &change = rendition_changes[ ((key * 0x9E3779B97F4A7C15ULL) >> 32) % RENDITION_CHANGES ];
+  if ( !(change.from == frame.current_rendition) || !(change.to == r) ) {
+    change.from = frame.current_rendition;
+    change.to = r;
+    change.sgr.clear();
+    r.sgr( frame.current_rendition, change.sgr );
+  }
 
-  return frame.str;
+  frame.appendstring( change.sgr );
+  frame.current_rendition = r;
 }
 
 void Display::put_cell( bool initialized, FrameState &frame, const Framebuffer &f ) const
 {
-  char tmp[ 64 ];
-
   const Cell *cell = f.get_cell( frame.y, frame.x );
 
   if ( !frame.force_next_put ) {
     if ( initialized
-	 && ( *cell == *(frame.last_frame.get_cell( frame.y, frame.x )) ) ) {
+	 && ( *cell == *(frame.get_last_cell( frame.y, frame.x )) ) ) {
       frame.x += cell->width;
       return;
     }
   }
 
   if ( (frame.x != frame.cursor_x) || (frame.y != frame.cursor_y) ) {
-    frame.append_silent_move( frame.y, frame.x );
+    append_silent_move( frame, f, frame.y, frame.x );
   }
 
-  if ( !(frame.current_rendition == cell->renditions) ) {
-    /* print renditions */
-    frame.appendstring( cell->renditions.sgr() );
-    frame.current_rendition = cell->renditions;
-  }
+  /* print renditions */
+  append_rendition( frame, cell->renditions );
 
-  if ( cell->contents.empty() ) {
+  if ( cell->empty() ) {
     /* see how far we can stretch a clear */
-    int clear_count = 0;
-    for ( int col = frame.x; col < f.ds.get_width(); col++ ) {
+    int clear_count = cells_run_length( cell, f.ds.get_width() - frame.x, *cell );
+    for ( int col = frame.x + clear_count; col < f.ds.get_width(); col++ ) {
       const Cell *other_cell = f.get_cell( frame.y, col );
       if ( (cell->renditions == other_cell->renditions)
-	   && (other_cell->contents.empty()) ) {
+	   && (other_cell->empty()) ) {
 	clear_count++;
       } else {
 	break;
@@ -362,6 +378,7 @@ void Display::put_cell( bool initialized, FrameState &frame, const Framebuffer &
     if ( frame.force_next_put ) {
       frame.append( " " );
       frame.cursor_x++;
+      frame.cursor_wrap_pending = false;
       frame.x++;
       frame.force_next_put = false;
       return;
@@ -377,14 +394,14 @@ void Display::put_cell( bool initialized, FrameState &frame, const Framebuffer &
 	if ( clear_count == 1 ) {
 	  frame.append( "\033[X" );
 	} else {
-	  snprintf( tmp, 64, "\033[%dX", clear_count );
-	  frame.append( tmp );
+	  frame.append_csi( clear_count, 'X' );
 	}
 	frame.x += clear_count;
       } else { /* no ECH, so just print a space */
 	/* unlike erases, this will use background color irrespective of BCE */
 	frame.append( " " );
 	frame.cursor_x++;
+	frame.cursor_wrap_pending = false;
 	frame.x++;
       }
     }
@@ -397,31 +414,494 @@ void Display::put_cell( bool initialized, FrameState &frame, const Framebuffer &
     frame.append( "\xC2\xA0" );
   }
 
-  for ( std::vector<wchar_t>::const_iterator i = cell->contents.begin();
-	i != cell->contents.end();
-	i++ ) {
-    snprintf( tmp, 64, "%lc", *i );
-    frame.append( tmp );
+  const wchar_t *contents = cell->contents_data();
+  for ( size_t i = 0; i < cell->contents_size(); i++ ) {
+    frame.append_char( contents[ i ] );
   }
 
   frame.x += cell->width;
   frame.cursor_x += cell->width;
+  frame.cursor_wrap_pending = false;
+
+  /* repeat it along the row? (The last column is left to be drawn
+     on its own, for the sake of the wrap hint.) */
+  if ( has_rep && (cell->width == 1) && (!cell->fallback) && (cell->contents_size() == 1)
+       && (frame.x < f.ds.get_width() - 1) ) {
+    const int repeats = cells_run_length( cell + 1, f.ds.get_width() - 1 - frame.x, *cell );
+    const int octets = ( contents[ 0 ] < 0x80 ) ? 1 : ( contents[ 0 ] < 0x800 ) ? 2 : ( contents[ 0 ] < 0x10000 ) ? 3 : 4;
+    if ( (repeats > 0) && (csi_count_length( repeats ) < repeats * octets) ) {
+      append_csi_count( frame, repeats, 'b' );
+      frame.x += repeats;
+      frame.cursor_x += repeats;
+    }
+  }
+
+  /* a wide character in the last column wraps on the real terminal */
+  if ( frame.cursor_x > f.ds.get_width() ) {
+    frame.cursor_x = frame.cursor_y = -1;
+  }
 
   frame.force_next_put = false;
 }
 
-void FrameState::append_silent_move( int y, int x )
+/* Move the cursor by the shortest sequence that this terminal
+   understands: CUP, or a horizontal move (CR, BS, CUF, CUB, CHA, or
+   printing again the cells already on the screen) followed by a
+   vertical one (LF, CUU, CUD or VPA). */
+void Display::append_silent_move( FrameState &frame, const Framebuffer &f, int y, int x ) const
 {
-  char tmp[ 64 ];
-
   /* turn off cursor if necessary before moving cursor */
-  if ( last_frame.ds.cursor_visible ) {
-    append( "\033[?25l" );
-    last_frame.ds.cursor_visible = false;
+  if ( frame.cursor_visible ) {
+    frame.append( "\033[?25l" );
+    frame.cursor_visible = false;
+  }
+
+  const int width = f.ds.get_width();
+  const int cup_cost = 3 + decimal_length( y + 1 ) + ( x ? 1 + decimal_length( x + 1 ) : 0 );
+
+  /* Relative moves need a known position. A cursor column of width
+     means the last write went into the last column, and the terminal
+     may be about to wrap: only absolute columns are safe. */
+  const bool row_known = (!frame.cursor_wrap_pending)
+    && (frame.cursor_y >= 0) && (frame.cursor_y < f.ds.get_height());
+  frame.cursor_wrap_pending = false;
+  const bool col_known = row_known && (frame.cursor_x >= 0) && (frame.cursor_x < width);
+
+  enum { H_NONE, H_CR, H_CR_CUF, H_CUF, H_BS, H_CUB, H_CHA, H_REPRINT } horizontal = H_CR_CUF;
+  enum { V_NONE, V_LF, V_CUD, V_CUU, V_VPA } vertical = V_NONE;
+  int h_cost = INT_MAX, v_cost = INT_MAX;
+
+  if ( row_known ) {
+    const int dx = x - frame.cursor_x;
+    const int dy = y - frame.cursor_y;
+
+    if ( col_known && (dx == 0) ) {
+      horizontal = H_NONE;
+      h_cost = 0;
+    } else {
+      horizontal = ( x == 0 ) ? H_CR : H_CR_CUF;
+      h_cost = ( x == 0 ) ? 1 : 1 + csi_count_length( x );
+      if ( has_hpa && (csi_count_length( x + 1 ) < h_cost) ) {
+	horizontal = H_CHA;
+	h_cost = csi_count_length( x + 1 );
+      }
+      if ( col_known && (dx > 0) ) {
+	if ( has_cursor_steps && (csi_count_length( dx ) < h_cost) ) {
+	  horizontal = H_CUF;
+	  h_cost = csi_count_length( dx );
+	}
+
+	/* cells that are already right can simply be printed again */
+	if ( (dy == 0) && (dx < h_cost) ) {
+	  int reprint_cost = 0;
+	  for ( int col = frame.cursor_x; col < x; col++ ) {
+	    const Cell *cell = f.get_cell( y, col );
+	    if ( (cell->width != 1) || cell->fallback || cell->empty()
+		 || !(cell->renditions == frame.current_rendition)
+		 || !(*cell == *frame.get_last_cell( y, col ))
+		 || (cell->contents_size() != 1) || (cell->contents_data()[ 0 ] >= 0x80) ) {
+	      reprint_cost = INT_MAX;
+	      break;
+	    }
+	    reprint_cost++;
+	  }
+	  if ( reprint_cost < h_cost ) {
+	    horizontal = H_REPRINT;
+	    h_cost = reprint_cost;
+	  }
+	}
+      } else if ( col_known && (dx < 0) ) {
+	if ( has_bs_left && (-dx < h_cost) ) {
+	  horizontal = H_BS;
+	  h_cost = -dx;
+	}
+	if ( has_cursor_steps && (csi_count_length( -dx ) < h_cost) ) {
+	  horizontal = H_CUB;
+	  h_cost = csi_count_length( -dx );
+	}
+      }
+    }
+
+    if ( dy == 0 ) {
+      vertical = V_NONE;
+      v_cost = 0;
+    } else {
+      if ( has_vpa ) {
+	vertical = V_VPA;
+	v_cost = csi_count_length( y + 1 );
+      }
+      if ( has_cursor_steps && (csi_count_length( dy > 0 ? dy : -dy ) < v_cost) ) {
+	vertical = ( dy > 0 ) ? V_CUD : V_CUU;
+	v_cost = csi_count_length( dy > 0 ? dy : -dy );
+      }
+      if ( has_lf_down && (dy > 0) && (dy < v_cost) ) {
+	vertical = V_LF;
+	v_cost = dy;
+      }
+    }
+  }
+
+  if ( (h_cost == INT_MAX) || (v_cost == INT_MAX) || (h_cost + v_cost >= cup_cost) ) {
+    if ( x ) {
+      frame.append_csi( y + 1, x + 1, 'H' );
+    } else {
+      frame.append_csi( y + 1, 'H' );
+    }
+    frame.cursor_x = x;
+    frame.cursor_y = y;
+    return;
+  }
+
+  /* the horizontal move goes first, to settle a pending wrap */
+  switch ( horizontal ) {
+  case H_NONE:
+    break;
+  case H_CR:
+    frame.append( '\r' );
+    break;
+  case H_CR_CUF:
+    frame.append( '\r' );
+    append_csi_count( frame, x, 'C' );
+    break;
+  case H_CUF:
+    append_csi_count( frame, x - frame.cursor_x, 'C' );
+    break;
+  case H_BS:
+    for ( int i = x; i < frame.cursor_x; i++ ) {
+      frame.append( '\b' );
+    }
+    break;
+  case H_CUB:
+    append_csi_count( frame, frame.cursor_x - x, 'D' );
+    break;
+  case H_CHA:
+    append_csi_count( frame, x + 1, 'G' );
+    break;
+  case H_REPRINT:
+    for ( int col = frame.cursor_x; col < x; col++ ) {
+      frame.append( char( f.get_cell( y, col )->contents_data()[ 0 ] ) );
+    }
+    break;
   }
 
-  snprintf( tmp, 64, "\033[%d;%dH", y + 1, x + 1 );
-  append( tmp );
-  cursor_x = x;
-  cursor_y = y;
+  switch ( vertical ) {
+  case V_NONE:
+    break;
+  case V_LF:
+    for ( int i = frame.cursor_y; i < y; i++ ) {
+      frame.append( '\n' );
+    }
+    break;
+  case V_CUD:
+    append_csi_count( frame, y - frame.cursor_y, 'B' );
+    break;
+  case V_CUU:
+    append_csi_count( frame, frame.cursor_y - y, 'A' );
+    break;
+  case V_VPA:
+    append_csi_count( frame, y + 1, 'd' );
+    break;
+  }
+
+  frame.cursor_x = x;
+  frame.cursor_y = y;
+}
+
+/* rough count of the octets needed to draw want over have, or
+   something over limit */
+static int row_draw_cost( const Row *want, const Row *have, int limit = INT_MAX )
+{
+  const size_t width = want->cells.size();
+  const Renditions *pen = NULL;
+  int cost = 0;
+
+  for ( size_t col = 0; (col < width) && (cost <= limit); ) {
+    col += cells_first_difference( &want->cells[ col ], &have->cells[ col ], width - col );
+    if ( col == width ) {
+      break;
+    }
+
+    cost += 4; /* getting there */
+    while ( (col < width) && !(want->cells[ col ] == have->cells[ col ]) ) {
+      const Cell &cell = want->cells[ col ];
+      if ( cell.empty() ) {
+	cost += 3; /* an erase */
+	col += cells_run_length( &cell, width - col, cell );
+	continue;
+      }
+      if ( (pen == NULL) || !(*pen == cell.renditions) ) {
+	cost += 8;
+	pen = &cell.renditions;
+      }
+      cost += cell.contents_size();
+      col++;
+    }
+  }
+  return cost;
+}
+
+static bool hash_less( const std::pair<uint64_t, int> &a, const std::pair<uint64_t, int> &b )
+{
+  return a.first < b.first;
+}
+
+/* Beyond this, a row is simply costly: a scroll costs far less. */
+static const int row_cost_limit = 64;
+
+static int cached_draw_cost( std::vector<int> &cache, int row, const Row *want, const Row *have )
+{
+  if ( cache[ row ] < 0 ) {
+    cache[ row ] = std::min( row_draw_cost( want, have, row_cost_limit ), row_cost_limit );
+  }
+  return cache[ row ];
+}
+
+/* Scroll rows top to bottom by count (up if positive, down if not)
+   in frame.last_rows, as the terminal does for IL, DL, IND and RI
+   with the default rendition. The terminal cannot have a wrap hint
+   on its bottom row, so if that row moves up it is replaced by a
+   copy without one, to be drawn again if it needs it. */
+static void scroll_rows( FrameState &frame, int top, int bottom, int count )
+{
+  std::vector<const Row *> &rows = frame.last_rows;
+  const int height = frame.last_frame.ds.get_height();
+
+  if ( rows.empty() ) {
+    for ( int i = 0; i < height; i++ ) {
+      rows.push_back( frame.last_frame.get_row( i ) );
+    }
+    frame.own_rows.push_back( Row( frame.last_frame.ds.get_width(), 0 ) );
+  }
+  const Row *blank = &frame.own_rows.front();
+
+  if ( (count > 0) && (bottom == height - 1) && rows[ bottom ]->get_wrap() ) {
+    frame.own_rows.push_back( *rows[ bottom ] );
+    frame.own_rows.back().set_wrap( false );
+    frame.own_rows.back().modify();
+    rows[ bottom ] = &frame.own_rows.back();
+  }
+
+  if ( count > 0 ) {
+    for ( int i = top; i <= bottom; i++ ) {
+      rows[ i ] = ( i + count <= bottom ) ? rows[ i + count ] : blank;
+    }
+  } else {
+    for ( int i = bottom; i >= top; i-- ) {
+      rows[ i ] = ( i + count >= top ) ? rows[ i + count ] : blank;
+    }
+  }
+}
+
+/* octets that append_scroll() will send */
+int Display::scroll_cost( const FrameState &frame, int height, int top, int bottom, int count ) const
+{
+  const int lines = ( count > 0 ) ? count : -count;
+  int cost = 0;
+
+  if ( !(frame.current_rendition == initial_rendition()) ) {
+    cost += 4;
+  }
+
+  const bool set_region = has_il_dl ? (bottom != height - 1) : ((top != 0) || (bottom != height - 1));
+  if ( set_region ) {
+    cost += 4 + decimal_length( top + 1 ) + decimal_length( bottom + 1 ); /* and homes */
+    cost += 5 + decimal_length( height ); /* back to the whole screen */
+  }
+
+  if ( has_il_dl ) {
+    cost += 3 + decimal_length( top + 1 ) + csi_count_length( lines );
+  } else {
+    cost += 3 + decimal_length( ( count > 0 ? bottom : top ) + 1 ) + lines * ( count > 0 ? 1 : 2 );
+  }
+
+  return cost;
+}
+
+/* Scroll rows top to bottom by count (up if positive, down if not),
+   on the terminal and in frame.last_rows. */
+void Display::append_scroll( FrameState &frame, const Framebuffer &f, int top, int bottom, int count ) const
+{
+  const int height = f.ds.get_height();
+
+  /* new lines get the current background */
+  if ( !(frame.current_rendition == initial_rendition()) ) {
+    frame.append( "\033[0m" );
+    frame.current_rendition = initial_rendition();
+  }
+
+  /* IL and DL are confined to the scrolling region only below the
+     cursor, but IND and RI only scroll at its margins */
+  const bool set_region = has_il_dl ? (bottom != height - 1) : ((top != 0) || (bottom != height - 1));
+  if ( set_region ) {
+    /* set scrolling region (which homes the cursor) */
+    frame.append_csi( top + 1, bottom + 1, 'r' );
+    frame.cursor_x = frame.cursor_y = -1;
+  }
+
+  if ( has_il_dl ) {
+    append_silent_move( frame, f, top, 0 );
+    if ( count > 0 ) {
+      append_csi_count( frame, count, 'M' );
+    } else {
+      append_csi_count( frame, -count, 'L' );
+    }
+  } else if ( count > 0 ) {
+    append_silent_move( frame, f, bottom, 0 );
+    for ( int i = 0; i < count; i++ ) {
+      frame.append( '\n' );
+    }
+  } else {
+    append_silent_move( frame, f, top, 0 );
+    for ( int i = 0; i < -count; i++ ) {
+      frame.append( "\033M" );
+    }
+  }
+
+  if ( set_region ) {
+    /* reset scrolling region */
+    frame.append_csi( 1, height, 'r' );
+  }
+
+  /* terminals differ on where IL and DL leave the cursor */
+  frame.cursor_x = frame.cursor_y = -1;
+
+  scroll_rows( frame, top, bottom, count );
+}
+
+/* Look for runs of rows that the new frame has at another height
+   than the last one, and scroll each into place while that is
+   cheaper than drawing the rows it fixes. Only changed rows are
+   looked up, and row comparison checks generations and cached
+   hashes before cells, so this is about one pass over the rows for
+   each changed row. */
+void Display::append_scrolls( FrameState &frame, const Framebuffer &f ) const
+{
+  const int height = f.ds.get_height();
+
+  const Row blank( f.ds.get_width(), 0 );
+
+  /* Which changed rows should be looked for? Only those that may be
+     somewhere else already, and not those that are quick to draw
+     from scratch (such as blank ones): they would match too much to
+     be worth it. */
+  std::vector<bool> wanted( height );
+  bool any_wanted = false;
+  for ( int row = 0; row < height; row++ ) {
+    const Row *want = f.get_row( row );
+    wanted[ row ] = false;
+    if ( *want == *(frame.get_last_row( row )) ) {
+      continue;
+    }
+    for ( int src = 0; src < height; src++ ) {
+      if ( frame.get_last_row( src )->hash() == want->hash() ) {
+	wanted[ row ] = row_draw_cost( want, &blank, 16 ) > 16;
+	break;
+      }
+    }
+    any_wanted = any_wanted || wanted[ row ];
+  }
+  if ( !any_wanted ) {
+    return;
+  }
+
+  /* cost of drawing each row over what is there now, and over a
+     blank row, worked out when first needed */
+  std::vector<int> cost( height, -1 ), blank_cost( height, -1 );
+
+  typedef std::pair<uint64_t, int> Hashed; /* (hash, row) */
+  std::vector<Hashed> sources( height );
+  typedef std::pair<int, int> Move; /* (shift, row): f row is last row + shift */
+  std::vector<Move> moves;
+  for ( int scrolls = 0; scrolls < height; scrolls++ ) {
+    /* where could the changed rows have come from? */
+    for ( int src = 0; src < height; src++ ) {
+      sources[ src ] = Hashed( frame.get_last_row( src )->hash(), src );
+    }
+    std::sort( sources.begin(), sources.end() );
+
+    moves.clear();
+    for ( int row = 0; row < height; row++ ) {
+      if ( !wanted[ row ] ) {
+	continue;
+      }
+      const Row *want = f.get_row( row );
+      for ( std::vector<Hashed>::const_iterator i = std::lower_bound( sources.begin(), sources.end(), Hashed( want->hash(), 0 ), hash_less );
+	    (i != sources.end()) && (i->first == want->hash());
+	    i++ ) {
+	if ( (i->second != row) && (*want == *(frame.get_last_row( i->second ))) ) {
+	  moves.push_back( Move( i->second - row, row ) );
+	}
+      }
+    }
+    if ( moves.empty() ) {
+      return;
+    }
+    std::sort( moves.begin(), moves.end() );
+
+    /* find the scroll that saves the most */
+    int best_saving = 0, best_top = 0, best_bottom = 0, best_count = 0;
+    int best_run = 0, best_run_end = 0;
+    int covered_shift = 0, covered_end = 0;
+    for ( std::vector<Move>::const_iterator i = moves.begin(); i != moves.end(); i++ ) {
+      const int shift = i->first;
+      if ( (shift == covered_shift) && (i->second < covered_end) ) {
+	continue; /* in the last run */
+      }
+
+      /* widen to the whole run of rows [run, run_end) that can come
+	 from shift rows below */
+      const int first = ( shift < 0 ) ? -shift : 0;
+      const int end = ( shift > 0 ) ? height - shift : height;
+      int run = i->second, run_end = i->second + 1;
+      while ( (run > first) && (*(f.get_row( run - 1 )) == *(frame.get_last_row( run - 1 + shift ))) ) {
+	run--;
+      }
+      while ( (run_end < end) && (*(f.get_row( run_end )) == *(frame.get_last_row( run_end + shift ))) ) {
+	run_end++;
+      }
+      covered_shift = shift;
+      covered_end = run_end;
+
+      int saving = 0;
+      for ( int row = run; row < run_end; row++ ) {
+	saving += cached_draw_cost( cost, row, f.get_row( row ), frame.get_last_row( row ) );
+      }
+
+      /* the rows scrolled in are blank */
+      const int top = ( shift > 0 ) ? run : run + shift;
+      const int bottom = ( shift > 0 ) ? run_end - 1 + shift : run_end - 1;
+      const int blank_first = ( shift > 0 ) ? run_end : top;
+      const int blank_end = ( shift > 0 ) ? bottom + 1 : run;
+      for ( int row = blank_first; row < blank_end; row++ ) {
+	saving += cached_draw_cost( cost, row, f.get_row( row ), frame.get_last_row( row ) )
+	  - cached_draw_cost( blank_cost, row, f.get_row( row ), &blank );
+      }
+
+      saving -= scroll_cost( frame, height, top, bottom, shift );
+      if ( saving > best_saving ) {
+	best_saving = saving;
+	best_top = top;
+	best_bottom = bottom;
+	best_count = shift;
+	best_run = run;
+	best_run_end = run_end;
+      }
+    }
+
+    if ( best_saving <= 0 ) {
+      return;
+    }
+
+    append_scroll( frame, f, best_top, best_bottom, best_count );
+
+    /* the run is in place, and the rest of the region is blank */
+    for ( int row = best_top; row <= best_bottom; row++ ) {
+      if ( (row >= best_run) && (row < best_run_end) ) {
+	cost[ row ] = 0;
+      } else {
+	cost[ row ] = blank_cost[ row ];
+      }
+      wanted[ row ] = wanted[ row ] && ( cost[ row ] != 0 );
+    }
+  }
 }
@@ -34,6 +34,7 @@
 #define TERMINALDISPLAY_HPP
 
 #include "terminalframebuffer.h"
+#include "terminaloutput.h"
 
 namespace Terminal {
   /* variables used within a new_frame */
@@ -41,26 +42,59 @@ namespace Terminal {
   public:
     int x, y;
     bool force_next_put;
-    std::string str;
+    std::string &str; /* owned by the caller, and reused from frame to frame */
 
     int cursor_x, cursor_y;
+    bool cursor_wrap_pending; /* cursor_x/y is where the next print will land, after a wrap */
+    bool cursor_visible;
     Renditions current_rendition;
 
-    Framebuffer last_frame;
+    /* The last frame is only read. Once rows have been scrolled,
+       last_rows says which row each screen row shows now, and rows
+       that are only on the terminal (such as the blank ones scrolled
+       in) are kept in own_rows. */
+    const Framebuffer &last_frame;
+    std::vector<const Row *> last_rows;
+    std::deque<Row> own_rows;
 
-    FrameState( const Framebuffer &s_last )
+    FrameState( const Framebuffer &s_last, std::string &s_str )
       : x(0), y(0),
 	force_next_put( false ),
-	str(), cursor_x(0), cursor_y(0), current_rendition( 0 ),
-	last_frame( s_last )
+	str( s_str ), cursor_x(0), cursor_y(0), cursor_wrap_pending( false ),
+	cursor_visible( s_last.ds.cursor_visible ),
+	current_rendition( 0 ),
+	last_frame( s_last ), last_rows(), own_rows()
     {
-      str.reserve( 1024 );
+      str.clear();
     }
 
+    const Row *get_last_row( int row ) const
+    {
+      return last_rows.empty() ? last_frame.get_row( row ) : last_rows[ row ];
+    }
+    const Cell *get_last_cell( int row, int col ) const { return &get_last_row( row )->cells[ col ]; }
+
+    void append( char c ) { str.push_back( c ); }
     void append( const char * s ) { str.append( s ); }
     void appendstring( const std::string &s ) { str.append( s ); }
+    void append_number( int n ) { append_decimal( str, n ); }
+    void append_char( wchar_t ch ) { append_utf8( str, ch ); }
 
-    void append_silent_move( int y, int x );
+    /* ESC [ n final, or ESC [ a ; b final */
+    void append_csi( int n, char final )
+    {
+      str.append( "\033[" );
+      append_decimal( str, n );
+      str.push_back( final );
+    }
+    void append_csi( int a, int b, char final )
+    {
+      str.append( "\033[" );
+      append_decimal( str, a );
+      str.push_back( ';' );
+      append_decimal( str, b );
+      str.push_back( final );
+    }
   };
 
   class Display {
@@ -78,9 +112,33 @@ namespace Terminal {
 
     int posterize_colors; /* downsample input colors >8 to [0..7] */
 
+    /* cursor motions, other than CUP and CR, that the terminal has */
+    bool has_lf_down; /* LF moves down (cud1) */
+    bool has_bs_left; /* BS moves left (cub1) */
+    bool has_cursor_steps; /* CUU, CUD, CUF and CUB with counts */
+    bool has_hpa, has_vpa; /* CHA and VPA, absolute column and row */
+    bool has_il_dl; /* IL and DL with counts */
+    bool has_rep; /* REP, to repeat the last character */
+
     const char *smcup, *rmcup; /* enter and exit alternate screen mode */
 
+    /* recent rendition changes, looked up by (from, to) */
+    class RenditionChange {
+    public:
+      Renditions from, to;
+      std::string sgr;
+
+      RenditionChange() : from( 0 ), to( 0 ), sgr() {}
+    };
+    static const int RENDITION_CHANGES = 64;
+    mutable RenditionChange rendition_changes[ RENDITION_CHANGES ];
+
+    void append_rendition( FrameState &frame, const Renditions &r ) const;
     void put_cell( bool initialized, FrameState &frame, const Framebuffer &f ) const;
+    void append_silent_move( FrameState &frame, const Framebuffer &f, int y, int x ) const;
+    int scroll_cost( const FrameState &frame, int height, int top, int bottom, int count ) const;
+    void append_scroll( FrameState &frame, const Framebuffer &f, int top, int bottom, int count ) const;
+    void append_scrolls( FrameState &frame, const Framebuffer &f ) const;
 
   public:
     void downgrade( Framebuffer &f ) const { if ( posterize_colors ) { f.posterize(); } }
@@ -90,6 +148,9 @@ namespace Terminal {
 
     std::string new_frame( bool initialized, const Framebuffer &last, const Framebuffer &f ) const;
 
+    /* same, but replaces the contents of out, keeping its storage */
+    void new_frame( bool initialized, const Framebuffer &last, const Framebuffer &f, std::string &out ) const;
+
     Display( bool use_environment );
   };
 }
@@ -89,7 +89,10 @@ const char *Display::ti_str( const char *capname ) const
 }
 
 Display::Display( bool use_environment )
-  : has_ech( true ), has_bce( true ), has_title( true ), posterize_colors( false ), smcup( NULL ), rmcup( NULL )
+  : has_ech( true ), has_bce( true ), has_title( true ), posterize_colors( false ),
+    has_lf_down( true ), has_bs_left( true ), has_cursor_steps( true ), has_hpa( true ), has_vpa( true ),
+    has_il_dl( true ), has_rep( false ), /* older mosh-clients lack REP */
+    smcup( NULL ), rmcup( NULL )
 {
   if ( use_environment ) {
     int errret = -2;
@@ -118,6 +121,17 @@ Display::Display( bool use_environment )
     /* check for BCE */
     has_bce = ti_flag( "bce" );
 
+    /* check for cursor motions (sent in their ECMA-48 forms) */
+    const char *cud1 = ti_str( "cud1" );
+    has_lf_down = cud1 && !strcmp( cud1, "\n" );
+    const char *cub1 = ti_str( "cub1" );
+    has_bs_left = cub1 && !strcmp( cub1, "\b" );
+    has_cursor_steps = ti_str( "cuu" ) && ti_str( "cud" ) && ti_str( "cuf" ) && ti_str( "cub" );
+    has_hpa = ti_str( "hpa" );
+    has_vpa = ti_str( "vpa" );
+    has_il_dl = ti_str( "il" ) && ti_str( "dl" );
+    has_rep = ti_str( "rep" );
+
     /* Check if we can set the window title and icon name.  terminfo does not
        have reliable information on this, so we hardcode a whitelist of
        terminal type prefixes.  This is the list from Debian's default
@@ -32,14 +32,243 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
+#include <map>
+#include <deque>
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 #include "terminalframebuffer.h"
+#include "terminaloutput.h"
 
 using namespace Terminal;
 
+/* Pool of interned combining-character sequences, shared by every
+   Cell in the process. Cells count their references to an entry.
+   An entry nobody refers to stays in the index, since text tends to
+   repeat itself, until its slot is wanted for a new sequence: the
+   pool holds the sequences on some screen plus about as many unused
+   ones, and never has to turn a sequence away. */
+class CombiningPool {
+private:
+  class Entry {
+  public:
+    std::vector<wchar_t> sequence;
+    uint64_t hash;
+    unsigned int references;
+    bool unused; /* listed in unused */
+
+    Entry() : sequence(), hash( 0 ), references( 0 ), unused( false ) {}
+  };
+
+  std::vector<Entry> entries;
+  std::deque<size_t> unused; /* oldest first; may have been reused since */
+  typedef std::multimap<uint64_t, size_t> index_type;
+  index_type index; /* hash to entry */
+
+  static const size_t MIN_UNUSED = 1024;
+
+  static uint64_t hash_step( uint64_t h, wchar_t c )
+  {
+    return ( h ^ uint64_t( c ) ) * 1099511628211ULL; /* FNV-1a */
+  }
+
+  /* a slot for a new entry, from the oldest unused entry if there are
+     enough of them */
+  size_t allocate( void )
+  {
+    while ( (unused.size() > MIN_UNUSED) && (unused.size() * 2 > entries.size()) ) {
+      size_t n = unused.front();
+      unused.pop_front();
+      Entry &entry = entries[ n ];
+      entry.unused = false;
+      if ( entry.references > 0 ) {
+	continue; /* in use again */
+      }
+
+      std::pair<index_type::iterator, index_type::iterator> range = index.equal_range( entry.hash );
+      for ( index_type::iterator i = range.first; i != range.second; i++ ) {
+	if ( i->second == n ) {
+	  index.erase( i );
+	  break;
+	}
+      }
+      return n;
+    }
+
+    entries.push_back( Entry() );
+    return entries.size() - 1;
+  }
+
+public:
+  CombiningPool() : entries(), unused(), index() {}
+
+  const std::vector<wchar_t> & get( size_t n ) const { return entries[ n ].sequence; }
+
+  void retain( size_t n ) { entries[ n ].references++; }
+
+  void release( size_t n )
+  {
+    Entry &entry = entries[ n ];
+    assert( entry.references > 0 );
+    if ( (--entry.references == 0) && !entry.unused ) {
+      entry.unused = true;
+      unused.push_back( n );
+    }
+  }
+
+  /* The entry for the sequence s[0..len) followed by c, with a
+     reference taken for the caller. s may point into the pool. */
+  size_t intern( const wchar_t *s, size_t len, wchar_t c )
+  {
+    uint64_t h = 14695981039346656037ULL;
+    for ( size_t i = 0; i < len; i++ ) {
+      h = hash_step( h, s[ i ] );
+    }
+    h = hash_step( h, c );
+
+    std::pair<index_type::const_iterator, index_type::const_iterator> range = index.equal_range( h );
+    for ( index_type::const_iterator i = range.first; i != range.second; i++ ) {
+      const std::vector<wchar_t> &seq = entries[ i->second ].sequence;
+      if ( (seq.size() == len + 1) && std::equal( s, s + len, seq.begin() ) && (seq.back() == c) ) {
+	retain( i->second );
+	return i->second;
+      }
+    }
+
+    std::vector<wchar_t> seq( s, s + len ); /* before entries can move */
+    seq.push_back( c );
+
+    size_t n = allocate();
+    Entry &entry = entries[ n ];
+    entry.sequence.swap( seq );
+    entry.hash = h;
+    entry.references = 1;
+    index.insert( index_type::value_type( h, n ) );
+    return n;
+  }
+};
+
+/* Constructed on first use to avoid the static initialization order
+   crash, and never destroyed, so that cells in static objects can
+   still let go of their contents at exit. */
+static CombiningPool & get_combining_pool( void )
+{
+  static CombiningPool *pool = new CombiningPool;
+  return *pool;
+}
+
+const std::vector<wchar_t> & Cell::overflow_sequence( wchar_t handle )
+{
+  return get_combining_pool().get( handle & ~OVERFLOW_FLAG );
+}
+
+void Cell::retain_sequence( wchar_t handle )
+{
+  get_combining_pool().retain( handle & ~OVERFLOW_FLAG );
+}
+
+void Cell::release_sequence( wchar_t handle )
+{
+  get_combining_pool().release( handle & ~OVERFLOW_FLAG );
+}
+
+void Cell::append( wchar_t c )
+{
+  assert( (c > 0) && (c < OVERFLOW_FLAG) );
+
+  if ( contents == 0 ) {
+    contents = c;
+    return;
+  }
+
+  size_t n = get_combining_pool().intern( contents_data(), contents_size(), c );
+  assert( n < size_t( OVERFLOW_FLAG ) );
+  release();
+  contents = OVERFLOW_FLAG | n;
+}
+
+/* the kernels below treat one Cell as one 16-byte lane */
+typedef char cell_is_sixteen_bytes[ ( sizeof( Cell ) == 16 ) ? 1 : -1 ];
+
+size_t Terminal::cells_first_difference( const Cell *a, const Cell *b, size_t n )
+{
+  size_t i = 0;
+
+#if defined(__AVX2__)
+  for ( ; i + 2 <= n; i += 2 ) {
+    __m256i va = _mm256_loadu_si256( reinterpret_cast<const __m256i *>( a + i ) );
+    __m256i vb = _mm256_loadu_si256( reinterpret_cast<const __m256i *>( b + i ) );
+    unsigned int mask = _mm256_movemask_epi8( _mm256_cmpeq_epi8( va, vb ) );
+    if ( mask != 0xFFFFFFFFu ) {
+      return ( ( mask & 0xFFFFu ) != 0xFFFFu ) ? i : i + 1;
+    }
+  }
+#endif
+
+#if defined(__SSE2__)
+  for ( ; i < n; i++ ) {
+    __m128i va = _mm_loadu_si128( reinterpret_cast<const __m128i *>( a + i ) );
+    __m128i vb = _mm_loadu_si128( reinterpret_cast<const __m128i *>( b + i ) );
+    if ( _mm_movemask_epi8( _mm_cmpeq_epi8( va, vb ) ) != 0xFFFF ) {
+      return i;
+    }
+  }
+#else
+  for ( ; i < n; i++ ) {
+    if ( memcmp( a + i, b + i, sizeof( Cell ) ) ) {
+      return i;
+    }
+  }
+#endif
+
+  return n;
+}
+
+size_t Terminal::cells_run_length( const Cell *cells, size_t n, const Cell &c )
+{
+  size_t i = 0;
+
+#if defined(__AVX2__)
+  __m256i pattern = _mm256_broadcastsi128_si256( _mm_loadu_si128( reinterpret_cast<const __m128i *>( &c ) ) );
+  for ( ; i + 2 <= n; i += 2 ) {
+    __m256i v = _mm256_loadu_si256( reinterpret_cast<const __m256i *>( cells + i ) );
+    unsigned int mask = _mm256_movemask_epi8( _mm256_cmpeq_epi8( v, pattern ) );
+    if ( mask != 0xFFFFFFFFu ) {
+      return ( ( mask & 0xFFFFu ) != 0xFFFFu ) ? i : i + 1;
+    }
+  }
+#endif
+
+#if defined(__SSE2__)
+  __m128i pattern128 = _mm_loadu_si128( reinterpret_cast<const __m128i *>( &c ) );
+  for ( ; i < n; i++ ) {
+    __m128i v = _mm_loadu_si128( reinterpret_cast<const __m128i *>( cells + i ) );
+    if ( _mm_movemask_epi8( _mm_cmpeq_epi8( v, pattern128 ) ) != 0xFFFF ) {
+      return i;
+    }
+  }
+#else
+  for ( ; i < n; i++ ) {
+    if ( memcmp( cells + i, &c, sizeof( Cell ) ) ) {
+      return i;
+    }
+  }
+#endif
+
+  return n;
+}
+
 void Cell::reset( int background_color )
 {
-  contents.clear();
+  release();
+  contents = 0;
   fallback = false;
   width = 1;
   renditions = Renditions( background_color );
@@ -69,27 +298,75 @@ DrawState::DrawState( int s_width, int s_height )
 }
 
 Framebuffer::Framebuffer( int s_width, int s_height )
-  : rows( s_height, Row( s_width, 0 ) ), icon_name(), window_title(), bell_count( 0 ), title_initialized( false ), ds( s_width, s_height )
+  : blank_row( new Row( s_width, 0 ) ), rows( s_height, blank_row ), row_offset( 0 ), icon_name(), window_title(), bell_count( 0 ), title_initialized( false ), ds( s_width, s_height )
 {
   assert( s_height > 0 );
   assert( s_width > 0 );
 }
 
+RowPointer Framebuffer::newrow( void )
+{
+  if ( (blank_row->cells.size() != size_t( ds.get_width() ))
+       || !(blank_row->cells.front() == Cell( ds.get_background_rendition() )) ) {
+    blank_row = RowPointer( new Row( ds.get_width(), ds.get_background_rendition() ) );
+  }
+
+  return blank_row;
+}
+
+void Framebuffer::reset_cells( int row, int start, int end )
+{
+  if ( (start == 0) && (end == ds.get_width()) ) {
+    reset_row( row );
+  } else if ( start < end ) {
+    get_mutable_row( row )->reset( start, end, ds.get_background_rendition() );
+  }
+}
+
+void Framebuffer::reverse_rows( int first, int last )
+{
+  while ( first < last ) {
+    rows[ physical_row( first ) ].swap( rows[ physical_row( last ) ] );
+    first++;
+    last--;
+  }
+}
+
+/* move rows top + N .. bottom up to top, and rows top .. top + N - 1
+   to the bottom of the region */
+void Framebuffer::rotate_rows( int top, int bottom, int N )
+{
+  int count = bottom - top + 1;
+  N %= count;
+  if ( N == 0 ) {
+    return;
+  }
+
+  if ( count == int( rows.size() ) ) {
+    row_offset = physical_row( N );
+    return;
+  }
+
+  reverse_rows( top, top + N - 1 );
+  reverse_rows( top + N, bottom );
+  reverse_rows( top, bottom );
+}
+
+/* The cursor moves as it would over N one-line scrolls: the first
+   step snaps a cursor outside the origin-mode margins inside them,
+   and the rest of the way is clamped to them. */
 void Framebuffer::scroll( int N )
 {
-  if ( N >= 0 ) {
-    for ( int i = 0; i < N; i++ ) {
-      delete_line( ds.get_scrolling_region_top_row() );
-      ds.move_row( -1, true );
-    }
-  } else {
+  if ( N > 0 ) {
+    delete_line( ds.get_scrolling_region_top_row(), N );
+    ds.move_row( -1, true );
+    ds.move_row( 1 - N, true );
+  } else if ( N < 0 ) {
     N = -N;
 
-    for ( int i = 0; i < N; i++ ) {
-      rows.insert( rows.begin() + ds.get_scrolling_region_top_row(), newrow() );
-      rows.erase( rows.begin() + ds.get_scrolling_region_bottom_row() + 1 );
-      ds.move_row( 1, true );
-    }
+    insert_line( ds.get_scrolling_region_top_row(), N );
+    ds.move_row( 1, true );
+    ds.move_row( N - 1, true );
   }
 }
 
@@ -170,7 +447,7 @@ Cell *Framebuffer::get_combining_cell( void )
     return NULL;
   } /* can happen if a resize came in between */
 
-  return &rows[ ds.get_combining_char_row() ].cells[ ds.get_combining_char_col() ];
+  return &get_mutable_row( ds.get_combining_char_row() )->cells[ ds.get_combining_char_col() ];
 }
 
 void DrawState::set_tab( void )
@@ -183,9 +460,9 @@ void DrawState::clear_tab( int col )
   tabs[ col ] = false;
 }
 
-int DrawState::get_next_tab( void )
+int DrawState::get_next_tab( int col ) const
 {
-  for ( int i = cursor_col + 1; i < width; i++ ) {
+  for ( int i = col + 1; i < width; i++ ) {
     if ( tabs[ i ] ) {
       return i;
     }
@@ -258,61 +535,113 @@ void DrawState::restore_cursor( void )
   new_grapheme();
 }
 
-void Framebuffer::insert_line( int before_row )
+void Framebuffer::insert_line( int before_row, int count )
 {
   if ( (before_row < ds.get_scrolling_region_top_row())
        || (before_row > ds.get_scrolling_region_bottom_row() + 1) ) {
     return;
   }
 
-  rows.insert( rows.begin() + before_row, newrow() );
-  rows.erase( rows.begin() + ds.get_scrolling_region_bottom_row() + 1 );
+  int bottom = ds.get_scrolling_region_bottom_row();
+  int region = bottom - before_row + 1;
+  if ( count > region ) {
+    count = region;
+  }
+
+  /* the bottom rows fall off; blank them and rotate them to the top */
+  for ( int i = bottom - count + 1; i <= bottom; i++ ) {
+    reset_row( i );
+  }
+  if ( count > 0 ) {
+    rotate_rows( before_row, bottom, region - count );
+  }
 }
 
-void Framebuffer::delete_line( int row )
+void Framebuffer::delete_line( int row, int count )
 {
   if ( (row < ds.get_scrolling_region_top_row())
        || (row > ds.get_scrolling_region_bottom_row()) ) {
     return;
   }
 
-  int insertbefore = ds.get_scrolling_region_bottom_row() + 1;
-  if ( insertbefore == ds.get_height() ) {
-    rows.push_back( newrow() );
-  } else {
-    rows.insert( rows.begin() + insertbefore, newrow() );
+  int bottom = ds.get_scrolling_region_bottom_row();
+  int region = bottom - row + 1;
+  if ( count > region ) {
+    count = region;
   }
 
-  rows.erase( rows.begin() + row );
+  /* the deleted rows are blanked and rotated to the bottom */
+  for ( int i = row; i < row + count; i++ ) {
+    reset_row( i );
+  }
+  rotate_rows( row, bottom, count );
 }
 
-void Row::insert_cell( int col, int background_color )
+/* A shift moves cells bytewise with one memmove, and their references
+   to combining sequences move with them (see Cell). So the cells
+   that go away are reset first, and the vacated span, which still
+   holds bytewise duplicates, is overwritten without releasing them. */
+static void fill_vacated( Row::cells_type::iterator start, int count, int background_color )
 {
-  cells.insert( cells.begin() + col, Cell( background_color ) );
-  cells.pop_back();
+  const Cell blank( background_color );
+  for ( int i = 0; i < count; i++ ) {
+    memcpy( static_cast<void *>( &*(start + i) ), &blank, sizeof( Cell ) );
+  }
 }
 
-void Row::delete_cell( int col, int background_color )
+void Row::insert_cell( int col, int count, int background_color )
 {
-  cells.push_back( Cell( background_color ) );
-  cells.erase( cells.begin() + col );
+  int width = cells.size();
+  if ( count > width - col ) {
+    count = width - col;
+  }
+  if ( count <= 0 ) {
+    return;
+  }
+
+  for ( int i = width - count; i < width; i++ ) {
+    cells[ i ].reset( background_color );
+  }
+  /* col + count may be the width, so index from the front */
+  Cell *base = &cells.front();
+  memmove( static_cast<void *>( base + col + count ), base + col, (width - col - count) * sizeof( Cell ) );
+  fill_vacated( cells.begin() + col, count, background_color );
 }
 
-void Framebuffer::insert_cell( int row, int col )
+void Row::delete_cell( int col, int count, int background_color )
 {
-  rows[ row ].insert_cell( col, ds.get_background_rendition() );
+  int width = cells.size();
+  if ( count > width - col ) {
+    count = width - col;
+  }
+  if ( count <= 0 ) {
+    return;
+  }
+
+  for ( int i = col; i < col + count; i++ ) {
+    cells[ i ].reset( background_color );
+  }
+  Cell *base = &cells.front(); /* as in insert_cell() */
+  memmove( static_cast<void *>( base + col ), base + col + count, (width - col - count) * sizeof( Cell ) );
+  fill_vacated( cells.end() - count, count, background_color );
+}
+
+void Framebuffer::insert_cell( int row, int col, int count )
+{
+  get_mutable_row( row )->insert_cell( col, count, ds.get_background_rendition() );
 }
 
-void Framebuffer::delete_cell( int row, int col )
+void Framebuffer::delete_cell( int row, int col, int count )
 {
-  rows[ row ].delete_cell( col, ds.get_background_rendition() );
+  get_mutable_row( row )->delete_cell( col, count, ds.get_background_rendition() );
 }
 
 void Framebuffer::reset( void )
 {
   int width = ds.get_width(), height = ds.get_height();
   ds = DrawState( width, height );
-  rows = std::deque<Row>( height, newrow() );
+  rows = rows_type( height, newrow() );
+  row_offset = 0;
   window_title.clear();
   /* do not reset bell_count */
 }
@@ -330,11 +659,10 @@ void Framebuffer::soft_reset( void )
 
 void Framebuffer::posterize( void )
 {
-  for ( rows_type::iterator i = rows.begin();
-        i != rows.end();
-        i++ ) {
-    for ( Row::cells_type::iterator j = i->cells.begin();
-          j != i->cells.end();
+  for ( int i = 0; i < ds.get_height(); i++ ) {
+    Row *row = get_mutable_row( i );
+    for ( Row::cells_type::iterator j = row->cells.begin();
+          j != row->cells.end();
           j++ ) {
       j->renditions.posterize();
     }
@@ -346,16 +674,29 @@ void Framebuffer::resize( int s_width, int s_height )
   assert( s_width > 0 );
   assert( s_height > 0 );
 
-  rows.resize( s_height, newrow() );
+  ds.resize( s_width, s_height );
 
-  for ( rows_type::iterator i = rows.begin();
-	i != rows.end();
-	i++ ) {
-    i->set_wrap( false );
-    i->cells.resize( s_width, Cell( ds.get_background_rendition() ) );
+  /* unroll the ring; resize is rare */
+  rows_type linear;
+  linear.reserve( s_height );
+  for ( int i = 0; i < s_height && i < int( rows.size() ); i++ ) {
+    linear.push_back( rows[ physical_row( i ) ] );
   }
+  rows.swap( linear );
+  row_offset = 0;
 
-  ds.resize( s_width, s_height );
+  rows.resize( s_height, newrow() );
+
+  for ( int i = 0; i < s_height; i++ ) {
+    /* leave rows that already fit shared with other snapshots */
+    if ( (rows[ i ]->cells.size() == size_t( s_width ))
+         && !rows[ i ]->get_wrap() ) {
+      continue;
+    }
+    Row *row = get_mutable_row( i );
+    row->set_wrap( false );
+    row->cells.resize( s_width, Cell( ds.get_background_rendition() ) );
+  }
 }
 
 void DrawState::resize( int s_width, int s_height )
@@ -389,108 +730,204 @@ void DrawState::resize( int s_width, int s_height )
 }
 
 Renditions::Renditions( int s_background )
-  : bold( false ), italic( false ), underlined( false ), blink( false ),
-    inverse( false ), invisible( false ), foreground_color( 0 ),
-    background_color( s_background )
-{}
+  : bits( 0 )
+{
+  set_color( BACKGROUND_SHIFT, s_background );
+}
 
 /* This routine cannot be used to set a color beyond the 16-color set. */
 void Renditions::set_rendition( int num )
 {
   if ( num == 0 ) {
-    bold = italic = underlined = blink = inverse = invisible = false;
-    foreground_color = background_color = 0;
+    bits = 0;
     return;
   }
 
   if ( num == 39 ) {
-    foreground_color = 0;
+    set_color( 0, 0 );
     return;
   } else if ( num == 49 ) {
-    background_color = 0;
+    set_color( BACKGROUND_SHIFT, 0 );
     return;
   }
 
   if ( (30 <= num) && (num <= 37) ) { /* foreground color in 8-color set */
-    foreground_color = num;
+    set_color( 0, num );
     return;
   } else if ( (40 <= num) && (num <= 47) ) { /* background color in 8-color set */
-    background_color = num;
+    set_color( BACKGROUND_SHIFT, num );
     return;
   } else if ( (90 <= num) && (num <= 97) ) { /* foreground color in 16-color set */
-    foreground_color = num - 90 + 38;
+    set_color( 0, num - 90 + 38 );
     return;
   } else if ( (100 <= num) && (num <= 107) ) { /* background color in 16-color set */
-    background_color = num - 100 + 48;
+    set_color( BACKGROUND_SHIFT, num - 100 + 48 );
     return;
   }
 
   switch ( num ) {
-  case 1: case 22: bold = (num == 1); break;
-  case 3: case 23: italic = (num == 3); break;
-  case 4: case 24: underlined = (num == 4); break;
-  case 5: case 25: blink = (num == 5); break;
-  case 7: case 27: inverse = (num == 7); break;
-  case 8: case 28: invisible = (num == 8); break;
+  case 1: case 22: set_attribute( bold, num == 1 ); break;
+  case 3: case 23: set_attribute( italic, num == 3 ); break;
+  case 4: case 24: set_attribute( underlined, num == 4 ); break;
+  case 5: case 25: set_attribute( blink, num == 5 ); break;
+  case 7: case 27: set_attribute( inverse, num == 7 ); break;
+  case 8: case 28: set_attribute( invisible, num == 8 ); break;
   }
 }
 
 void Renditions::set_foreground_color( int num )
 {
   if ( (0 <= num) && (num <= 255) ) {
-    foreground_color = 30 + num;
+    set_color( 0, 30 + num );
   }
 }
 
 void Renditions::set_background_color( int num )
 {
   if ( (0 <= num) && (num <= 255) ) {
-    background_color = 40 + num;
+    set_color( BACKGROUND_SHIFT, 40 + num );
   }
 }
 
-std::string Renditions::sgr( void ) const
+static bool valid_rgb( int red, int green, int blue )
+{
+  return ( (0 <= red) && (red <= 255)
+	   && (0 <= green) && (green <= 255)
+	   && (0 <= blue) && (blue <= 255) );
+}
+
+void Renditions::set_foreground_rgb( int red, int green, int blue )
 {
-  std::string ret;
+  if ( valid_rgb( red, green, blue ) ) {
+    set_color( 0, TRUE_COLOR | (red << 16) | (green << 8) | blue );
+  }
+}
+
+void Renditions::set_background_rgb( int red, int green, int blue )
+{
+  if ( valid_rgb( red, green, blue ) ) {
+    set_color( BACKGROUND_SHIFT, TRUE_COLOR | (red << 16) | (green << 8) | blue );
+  }
+}
+
+static void append_color( std::string &ret, int color, int base )
+{
+  ret.append( "\033[" );
+  append_decimal( ret, base + 8 );
+  if ( color & Renditions::TRUE_COLOR ) { /* use 24-bit color */
+    ret.append( ";2;" );
+    append_decimal( ret, (color >> 16) & 0xff );
+    ret.push_back( ';' );
+    append_decimal( ret, (color >> 8) & 0xff );
+    ret.push_back( ';' );
+    append_decimal( ret, color & 0xff );
+  } else { /* use 256-color set */
+    ret.append( ";5;" );
+    append_decimal( ret, color - base );
+  }
+  ret.push_back( 'm' );
+}
+
+void Renditions::sgr( std::string &ret ) const
+{
+  int foreground_color = get_foreground_color();
+  int background_color = get_background_color();
 
   ret.append( "\033[0" );
-  if ( bold ) ret.append( ";1" );
-  if ( italic ) ret.append( ";3" );
-  if ( underlined ) ret.append( ";4" );
-  if ( blink ) ret.append( ";5" );
-  if ( inverse ) ret.append( ";7" );
-  if ( invisible ) ret.append( ";8" );
+  if ( get_attribute( bold ) ) ret.append( ";1" );
+  if ( get_attribute( italic ) ) ret.append( ";3" );
+  if ( get_attribute( underlined ) ) ret.append( ";4" );
+  if ( get_attribute( blink ) ) ret.append( ";5" );
+  if ( get_attribute( inverse ) ) ret.append( ";7" );
+  if ( get_attribute( invisible ) ) ret.append( ";8" );
 
   if ( foreground_color
        && (foreground_color <= 37) ) {
     /* ANSI foreground color */
-    char col[ 8 ];
-    snprintf( col, 8, ";%d", foreground_color );
-    ret.append( col );
+    ret.push_back( ';' );
+    append_decimal( ret, foreground_color );
   }
 
   if ( background_color
        && (background_color <= 47) ) {
-    char col[ 8 ];
-    snprintf( col, 8, ";%d", background_color );
-    ret.append( col );
+    ret.push_back( ';' );
+    append_decimal( ret, background_color );
   }
 
   ret.append( "m" );
 
-  if ( foreground_color > 37 ) { /* use 256-color set */
-    char col[ 64 ];
-    snprintf( col, 64, "\033[38;5;%dm", foreground_color - 30 );
-    ret.append( col );
+  if ( foreground_color > 37 ) {
+    append_color( ret, foreground_color, 30 );
   }
 
-  if ( background_color > 47 ) { /* use 256-color set */
-    char col[ 64 ];
-    snprintf( col, 64, "\033[48;5;%dm", background_color - 40 );
-    ret.append( col );
+  if ( background_color > 47 ) {
+    append_color( ret, background_color, 40 );
   }
+}
 
-  return ret;
+/* Change from one rendition to this one, by turning off and on just
+   the attributes and colors that differ, unless starting over from a
+   reset is shorter. */
+void Renditions::sgr( const Renditions &from, std::string &ret ) const
+{
+  static const int attribute_on[ SIZE ] = { 1, 3, 4, 5, 7, 8 };
+  static const int attribute_off[ SIZE ] = { 22, 23, 24, 25, 27, 28 };
+
+  if ( bits == from.bits ) {
+    return;
+  }
+
+  std::string change( "\033[" );
+  bool params = false;
+  for ( int i = 0; i < SIZE; i++ ) {
+    attribute_type attr = attribute_type( i );
+    if ( get_attribute( attr ) != from.get_attribute( attr ) ) {
+      if ( params ) {
+	change.push_back( ';' );
+      }
+      append_decimal( change, get_attribute( attr ) ? attribute_on[ i ] : attribute_off[ i ] );
+      params = true;
+    }
+  }
+
+  int foreground_color = get_foreground_color();
+  int background_color = get_background_color();
+  bool foreground_changed = foreground_color != from.get_foreground_color();
+  bool background_changed = background_color != from.get_background_color();
+
+  if ( foreground_changed && (foreground_color <= 37) ) {
+    if ( params ) {
+      change.push_back( ';' );
+    }
+    append_decimal( change, foreground_color ? foreground_color : 39 );
+    params = true;
+  }
+
+  if ( background_changed && (background_color <= 47) ) {
+    if ( params ) {
+      change.push_back( ';' );
+    }
+    append_decimal( change, background_color ? background_color : 49 );
+    params = true;
+  }
+
+  if ( params ) {
+    change.push_back( 'm' );
+  } else {
+    change.clear();
+  }
+
+  if ( foreground_changed && (foreground_color > 37) ) {
+    append_color( change, foreground_color, 30 );
+  }
+
+  if ( background_changed && (background_color > 47) ) {
+    append_color( change, background_color, 40 );
+  }
+
+  std::string reset;
+  sgr( reset );
+  ret.append( (change.size() < reset.size()) ? change : reset );
 }
 
 /* Reduce 256 "standard" colors to the 8 ANSI colors. */
@@ -535,24 +972,74 @@ static const char standard_posterization[] = {
   7, 7, 3, 3, 3, 3, 7, 7, 0, 0, 0, 0, 0, 0, 0, 0,
   0, 0, 1, 1, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7 };
 
+/* Reduce a 24-bit color to the nearest entry of the 6x6x6 color cube. */
+static int cube_index( int color )
+{
+  int red = (color >> 16) & 0xff, green = (color >> 8) & 0xff, blue = color & 0xff;
+  return 16 + 36 * ((red * 5 + 127) / 255) + 6 * ((green * 5 + 127) / 255) + ((blue * 5 + 127) / 255);
+}
+
+static int posterize_color( int color, int base )
+{
+  if ( !color ) {
+    return 0;
+  }
+
+  int index = (color & Renditions::TRUE_COLOR) ? cube_index( color ) : color - base;
+  return base + standard_posterization[ index ];
+}
+
 void Renditions::posterize( void )
 {
-  if ( foreground_color ) {
-    foreground_color = 30 + standard_posterization[ foreground_color - 30 ];
+  set_color( 0, posterize_color( get_foreground_color(), 30 ) );
+  set_color( BACKGROUND_SHIFT, posterize_color( get_background_color(), 40 ) );
+}
+
+bool Framebuffer::operator==( const Framebuffer &x ) const
+{
+  if ( !( (ds == x.ds) && (window_title == x.window_title) && (bell_count == x.bell_count) ) ) {
+    return false;
   }
 
-  if ( background_color ) {
-    background_color = 40 + standard_posterization[ background_color - 40 ];
+  for ( int i = 0; i < ds.get_height(); i++ ) {
+    if ( !(*get_row( i ) == *x.get_row( i )) ) {
+      return false;
+    }
   }
+
+  return true;
 }
 
-void Row::reset( int background_color )
+uint64_t Row::get_gen( void )
 {
-  for ( cells_type::iterator i = cells.begin();
+  static uint64_t gen_counter = 0;
+  return ++gen_counter;
+}
+
+uint64_t Row::compute_hash( void ) const
+{
+  uint64_t h = 14695981039346656037ULL; /* FNV-1a over one word per cell */
+  for ( cells_type::const_iterator i = cells.begin();
 	i != cells.end();
 	i++ ) {
-    i->reset( background_color );
+    h ^= i->hash();
+    h *= 1099511628211ULL;
+    h ^= h >> 29;
+  }
+  return h;
+}
+
+void Row::reset( int background_color )
+{
+  reset( 0, cells.size(), background_color );
+}
+
+void Row::reset( int start, int end, int background_color )
+{
+  for ( int i = start; i < end; i++ ) {
+    cells[ i ].clear();
   }
+  fill_vacated( cells.begin() + start, end - start, background_color );
 }
 
 void Framebuffer::prefix_window_title( const std::deque<wchar_t> &s )
@@ -575,10 +1062,10 @@ void Framebuffer::prefix_window_title( const std::deque<wchar_t> &s )
 
 wchar_t Cell::debug_contents( void ) const
 {
-  if ( contents.empty() ) {
+  if ( empty() ) {
     return '_';
   } else {
-    return contents.front();
+    return contents_data()[ 0 ];
   }
 }
 
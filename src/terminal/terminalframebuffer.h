@@ -38,59 +38,140 @@
 #include <string>
 #include <list>
 #include <assert.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "terminalarena.h"
 
 /* Terminal framebuffer */
 
 namespace Terminal {
   class Renditions {
   public:
-    bool bold, italic, underlined, blink, inverse, invisible;
-    int foreground_color;
-    int background_color;
+    typedef enum { bold, italic, underlined, blink, inverse, invisible, SIZE } attribute_type;
+
+    /* Colors are 0 (default), 30-37/40-47 (ANSI), 38-285/48-295 (the
+       256-color set, offset by 30/40), or TRUE_COLOR plus 24-bit RGB. */
+    static const int TRUE_COLOR = 0x1000000;
+
+  private:
+    /* Everything is packed into one word so that comparing two
+       renditions is a single integer compare. */
+    uint64_t bits;
+
+    static const int COLOR_BITS = 25;
+    static const uint64_t COLOR_MASK = (uint64_t( 1 ) << COLOR_BITS) - 1;
+    static const int BACKGROUND_SHIFT = COLOR_BITS;
+    static const int ATTRIBUTE_SHIFT = 2 * COLOR_BITS;
 
+    void set_color( int shift, int color )
+    {
+      bits = (bits & ~(COLOR_MASK << shift)) | (uint64_t( color ) & COLOR_MASK) << shift;
+    }
+
+  public:
     Renditions( int s_background );
     void set_foreground_color( int num );
     void set_background_color( int num );
+    void set_foreground_rgb( int red, int green, int blue );
+    void set_background_rgb( int red, int green, int blue );
     void set_rendition( int num );
-    std::string sgr( void ) const;
+    void sgr( std::string &out ) const; /* appends the SGR sequence */
+    void sgr( const Renditions &from, std::string &out ) const; /* appends the shortest SGR sequence from another rendition */
 
     void posterize( void );
 
-    bool operator==( const Renditions &x ) const
+    int get_foreground_color( void ) const { return bits & COLOR_MASK; }
+    int get_background_color( void ) const { return (bits >> BACKGROUND_SHIFT) & COLOR_MASK; }
+
+    bool get_attribute( attribute_type attr ) const { return (bits >> (ATTRIBUTE_SHIFT + attr)) & 1; }
+    void set_attribute( attribute_type attr, bool val )
     {
-      return (bold == x.bold) && (italic == x.italic) && (underlined == x.underlined)
-	&& (blink == x.blink) && (inverse == x.inverse)
-	&& (invisible == x.invisible) && (foreground_color == x.foreground_color)
-	&& (background_color == x.background_color);
+      uint64_t mask = uint64_t( 1 ) << (ATTRIBUTE_SHIFT + attr);
+      bits = val ? (bits | mask) : (bits & ~mask);
     }
+
+    bool operator==( const Renditions &x ) const { return bits == x.bits; }
+    uint64_t hash( void ) const { return bits; }
   };
 
   class Cell {
   public:
-    std::vector<wchar_t> contents;
-    char fallback; /* first character is combining character */
-    int width;
     Renditions renditions;
+    unsigned char width;
+    bool fallback; /* first character is combining character */
     bool wrap; /* if last cell, wrap to next line */
 
+  private:
+    /* Always zero. Naming the byte the compiler would otherwise leave
+       as padding lets whole rows be compared bytewise (see
+       cells_first_difference() below). */
+    unsigned char reserved;
+
+    /* The contents are either one code point, stored inline, or (for
+       a grapheme with combining characters) a handle to a sequence in
+       a process-wide pool. Sequences are interned, so equal contents
+       always have equal handles. Zero means the cell is empty. This
+       keeps Cell free of heap storage, and with the fields above it
+       packs into 16 bytes. Each cell holding a handle counts as a
+       reference to its sequence, which is freed with the last one. */
+    wchar_t contents;
+
+    static const wchar_t OVERFLOW_FLAG = 0x40000000;
+    static const size_t MAX_CONTENTS = 16; /* seems like a reasonable limit on combining characters */
+
+    bool overflowed( void ) const { return contents & OVERFLOW_FLAG; }
+    static const std::vector<wchar_t> & overflow_sequence( wchar_t handle );
+    static void retain_sequence( wchar_t handle );
+    static void release_sequence( wchar_t handle );
+
+    void retain( void ) const { if ( overflowed() ) { retain_sequence( contents ); } }
+    void release( void ) const { if ( overflowed() ) { release_sequence( contents ); } }
+
+  public:
     Cell( int background_color )
-      : contents(),
-	fallback( false ),
+      : renditions( background_color ),
 	width( 1 ),
-	renditions( background_color ),
-	wrap( false )
+	fallback( false ),
+	wrap( false ),
+	reserved( 0 ),
+	contents( 0 )
     {}
 
     Cell() /* default constructor required by C++11 STL */
-      : contents(),
-	fallback( false ),
+      : renditions( 0 ),
 	width( 1 ),
-	renditions( 0 ),
-	wrap( false )
+	fallback( false ),
+	wrap( false ),
+	reserved( 0 ),
+	contents( 0 )
     {
       assert( false );
     }
 
+    /* bytewise, as reserved is zero in both */
+    Cell( const Cell &x )
+      : renditions( x.renditions ),
+	width(),
+	fallback(),
+	wrap(),
+	reserved(),
+	contents()
+    {
+      memcpy( static_cast<void *>( this ), &x, sizeof( Cell ) );
+      retain();
+    }
+
+    Cell & operator=( const Cell &x )
+    {
+      x.retain();
+      release();
+      memcpy( static_cast<void *>( this ), &x, sizeof( Cell ) );
+      return *this;
+    }
+
+    ~Cell() { release(); }
+
     void reset( int background_color );
 
     bool operator==( const Cell &x ) const
@@ -102,13 +183,36 @@ namespace Terminal {
 	       && (wrap == x.wrap) );
     }
 
+    bool empty( void ) const { return contents == 0; }
+    bool full( void ) const { return contents_size() >= MAX_CONTENTS; }
+    void clear( void ) { release(); contents = 0; }
+    void append( wchar_t c );
+
+    size_t contents_size( void ) const
+    {
+      if ( overflowed() ) {
+	return overflow_sequence( contents ).size();
+      }
+      return contents ? 1 : 0;
+    }
+
+    /* valid until the cell is next modified */
+    const wchar_t *contents_data( void ) const
+    {
+      if ( overflowed() ) {
+	return &overflow_sequence( contents ).front();
+      }
+      return &contents;
+    }
+
     wchar_t debug_contents( void ) const;
 
     bool is_blank( void ) const
     {
-      return ( contents.empty()
-	       || ( (contents.size() == 1) && ( (contents.front() == 0x20)
-						|| (contents.front() == 0xA0) ) ) );
+      /* a pooled sequence is never a single code point */
+      return ( (contents == 0)
+	       || (contents == 0x20)
+	       || (contents == 0xA0) );
     }
 
     bool contents_match ( const Cell& other ) const
@@ -118,37 +222,170 @@ namespace Terminal {
     }
 
     bool compare( const Cell &other ) const;
+
+    /* consistent with operator== (pooled sequences are interned) */
+    uint64_t hash( void ) const
+    {
+      return ( renditions.hash() * 0x9E3779B97F4A7C15ULL )
+	^ ( uint64_t( contents )
+	    | ( uint64_t( width ) << 32 )
+	    | ( uint64_t( fallback ) << 40 )
+	    | ( uint64_t( wrap ) << 41 ) );
+    }
   };
 
+  /* Bytewise scans over runs of cells, vectorized where the compiler
+     targets SSE2 or AVX2. Cells compare equal bytewise exactly when
+     operator== says they do. */
+
+  /* index of the first cell at which a and b differ, or n */
+  size_t cells_first_difference( const Cell *a, const Cell *b, size_t n );
+
+  /* number of leading cells identical to c */
+  size_t cells_run_length( const Cell *cells, size_t n, const Cell &c );
+
   class Row {
+  private:
+    /* number of RowPointers sharing this row; not part of its value */
+    unsigned int refcount;
+
+    friend class RowPointer;
+
+    static uint64_t get_gen( void );
+
+    /* cached hash of cells, invalidated by modify() */
+    mutable uint64_t hash_value;
+    mutable bool hash_valid;
+
+    uint64_t compute_hash( void ) const;
+
   public:
-    typedef std::vector<Cell> cells_type;
+    typedef std::vector<Cell, ArenaAllocator<Cell> > cells_type;
     cells_type cells;
 
+    /* Generation number, drawn from a process-wide counter whenever the
+       row is created or handed out for modification. Two rows with the
+       same generation have the same contents, so unchanged rows can be
+       skipped without comparing their cells. */
+    uint64_t gen;
+
     Row( size_t s_width, int background_color )
-      : cells( s_width, Cell( background_color ) )
+      : refcount( 0 ), hash_value( 0 ), hash_valid( false ),
+        cells( s_width, Cell( background_color ) ), gen( get_gen() )
     {}
 
     Row() /* default constructor required by C++11 STL */
-      : cells( 1, Cell() )
+      : refcount( 0 ), hash_value( 0 ), hash_valid( false ),
+        cells( 1, Cell() ), gen( get_gen() )
     {
       assert( false );
     }
 
-    void insert_cell( int col, int background_color );
-    void delete_cell( int col, int background_color );
+    Row( const Row &x )
+      : refcount( 0 ), hash_value( x.hash_value ), hash_valid( x.hash_valid ),
+        cells( x.cells ), gen( x.gen )
+    {}
+
+    Row & operator=( const Row &x )
+    {
+      cells = x.cells;
+      gen = x.gen;
+      hash_value = x.hash_value;
+      hash_valid = x.hash_valid;
+      return *this;
+    }
+
+    static void *operator new( size_t size ) { return Arena::allocate( size ); }
+    static void operator delete( void *p, size_t size ) { Arena::release( p, size ); }
+
+    void modify( void ) { gen = get_gen(); hash_valid = false; }
+
+    /* Fingerprint of the cells. Rows with different hashes differ;
+       rows with equal hashes still need operator== to confirm.
+       Only valid on rows that are not being modified through a
+       pointer obtained before the call. */
+    uint64_t hash( void ) const
+    {
+      if ( !hash_valid ) {
+        hash_value = compute_hash();
+        hash_valid = true;
+      }
+      return hash_value;
+    }
+
+    /* shift cells right (dropping them off the end) or left (filling
+       in blanks at the end) by count columns */
+    void insert_cell( int col, int count, int background_color );
+    void delete_cell( int col, int count, int background_color );
 
     void reset( int background_color );
+    void reset( int start, int end, int background_color ); /* cells [start, end) */
 
     bool operator==( const Row &x ) const
     {
-      return ( cells == x.cells );
+      return ( gen == x.gen )
+        || ( ( hash() == x.hash() )
+             && ( cells.size() == x.cells.size() )
+             && ( cells_first_difference( &cells.front(), &x.cells.front(), cells.size() ) == cells.size() ) );
     }
 
     bool get_wrap( void ) const { return cells.back().wrap; }
     void set_wrap( bool w ) { cells.back().wrap = w; }
   };
 
+  /* Reference-counted handle to a Row. Copying a Framebuffer copies
+     only these handles; a shared row is copied the first time one of
+     its owners asks for it through get_mutable(). Not thread-safe,
+     like the rest of the terminal state. */
+  class RowPointer {
+  private:
+    Row *row;
+
+    void release( void )
+    {
+      if ( --row->refcount == 0 ) {
+        delete row;
+      }
+    }
+
+  public:
+    explicit RowPointer( Row *s_row ) : row( s_row ) { row->refcount++; }
+    RowPointer( const RowPointer &x ) : row( x.row ) { row->refcount++; }
+    ~RowPointer() { release(); }
+
+    RowPointer & operator=( const RowPointer &x )
+    {
+      x.row->refcount++;
+      release();
+      row = x.row;
+      return *this;
+    }
+
+    const Row & operator*( void ) const { return *row; }
+    const Row * operator->( void ) const { return row; }
+    const Row * get( void ) const { return row; }
+
+    bool unique( void ) const { return row->refcount == 1; }
+
+    Row *get_mutable( void )
+    {
+      if ( !unique() ) {
+        Row *copy = new Row( *row );
+        copy->refcount++;
+        release();
+        row = copy;
+      }
+      return row;
+    }
+
+    void swap( RowPointer &x )
+    {
+      Row *tmp = row;
+      row = x.row;
+      x.row = tmp;
+    }
+  };
+
   class SavedCursor {
   public:
     int cursor_col, cursor_row;
@@ -213,7 +450,8 @@ namespace Terminal {
     void clear_tab( int col );
     void clear_default_tabs( void ) { default_tabs = false; }
     /* Default tabs can't be restored without resetting the draw state. */
-    int get_next_tab( void );
+    int get_next_tab( void ) { return get_next_tab( cursor_col ); }
+    int get_next_tab( int col ) const;
 
     void set_scrolling_region( int top, int bottom );
 
@@ -225,9 +463,11 @@ namespace Terminal {
 
     void set_foreground_color( int x ) { renditions.set_foreground_color( x ); }
     void set_background_color( int x ) { renditions.set_background_color( x ); }
+    void set_foreground_rgb( int r, int g, int b ) { renditions.set_foreground_rgb( r, g, b ); }
+    void set_background_rgb( int r, int g, int b ) { renditions.set_background_rgb( r, g, b ); }
     void add_rendition( int x ) { renditions.set_rendition( x ); }
     Renditions get_renditions( void ) const { return renditions; }
-    int get_background_rendition( void ) const { return renditions.background_color; }
+    int get_background_rendition( void ) const { return renditions.get_background_color(); }
 
     void save_cursor( void );
     void restore_cursor( void );
@@ -251,14 +491,29 @@ namespace Terminal {
 
   class Framebuffer {
   private:
-    typedef std::deque<Row> rows_type;
+    /* Rows are stored as a ring: screen row r lives at
+       rows[ (r + row_offset) % height ], so scrolling the whole
+       screen only moves row_offset. */
+    typedef std::vector<RowPointer> rows_type;
+    RowPointer blank_row; /* shared by every erased, unwritten row */
     rows_type rows;
+    int row_offset;
     std::deque<wchar_t> icon_name;
     std::deque<wchar_t> window_title;
     unsigned int bell_count;
     bool title_initialized; /* true if the window title has been set via an OSC */
 
-    Row newrow( void ) { return Row( ds.get_width(), ds.get_background_rendition() ); }
+    RowPointer newrow( void );
+
+    int physical_row( int row ) const
+    {
+      int i = row + row_offset;
+      int height = rows.size();
+      return ( i >= height ) ? i - height : i;
+    }
+
+    void reverse_rows( int first, int last );
+    void rotate_rows( int top, int bottom, int N );
 
   public:
     Framebuffer( int s_width, int s_height );
@@ -271,12 +526,12 @@ namespace Terminal {
     {
       if ( row == -1 ) row = ds.get_cursor_row();
 
-      return &rows[ row ];
+      return rows[ physical_row( row ) ].get();
     }
 
     inline const Cell *get_cell( void ) const
     {
-      return &rows[ ds.get_cursor_row() ].cells[ ds.get_cursor_col() ];
+      return &get_row( -1 )->cells[ ds.get_cursor_col() ];
     }
 
     inline const Cell *get_cell( int row, int col ) const
@@ -284,19 +539,21 @@ namespace Terminal {
       if ( row == -1 ) row = ds.get_cursor_row();
       if ( col == -1 ) col = ds.get_cursor_col();
 
-      return &rows[ row ].cells[ col ];
+      return &get_row( row )->cells[ col ];
     }
 
     Row *get_mutable_row( int row )
     {
       if ( row == -1 ) row = ds.get_cursor_row();
 
-      return &rows[ row ];
+      Row *mutable_row = rows[ physical_row( row ) ].get_mutable();
+      mutable_row->modify();
+      return mutable_row;
     }
 
     inline Cell *get_mutable_cell( void )
     {
-      return &rows[ ds.get_cursor_row() ].cells[ ds.get_cursor_col() ];
+      return &get_mutable_row( -1 )->cells[ ds.get_cursor_col() ];
     }
 
     inline Cell *get_mutable_cell( int row, int col )
@@ -304,18 +561,18 @@ namespace Terminal {
       if ( row == -1 ) row = ds.get_cursor_row();
       if ( col == -1 ) col = ds.get_cursor_col();
 
-      return &rows[ row ].cells[ col ];
+      return &get_mutable_row( row )->cells[ col ];
     }
 
     Cell *get_combining_cell( void );
 
     void apply_renditions_to_current_cell( void );
 
-    void insert_line( int before_row );
-    void delete_line( int row );
+    void insert_line( int before_row, int count = 1 );
+    void delete_line( int row, int count = 1 );
 
-    void insert_cell( int row, int col );
-    void delete_cell( int row, int col );
+    void insert_cell( int row, int col, int count = 1 );
+    void delete_cell( int row, int col, int count = 1 );
 
     void reset( void );
     void soft_reset( void );
@@ -332,17 +589,25 @@ namespace Terminal {
     void resize( int s_width, int s_height );
 
     void reset_cell( Cell *c ) { c->reset( ds.get_background_rendition() ); }
-    void reset_row( Row *r ) { r->reset( ds.get_background_rendition() ); }
+
+    /* Erased rows all point at one shared blank row (with a single
+       generation), so clearing is a handle assignment and cleared rows
+       compare equal without looking at their cells. */
+    void reset_row( int row )
+    {
+      if ( row == -1 ) row = ds.get_cursor_row();
+
+      rows[ physical_row( row ) ] = newrow();
+    }
+
+    void reset_cells( int row, int start, int end ); /* [start, end) */
 
     void posterize( void );
 
     void ring_bell( void ) { bell_count++; }
     unsigned int get_bell_count( void ) const { return bell_count; }
 
-    bool operator==( const Framebuffer &x ) const
-    {
-      return ( rows == x.rows ) && ( window_title == x.window_title ) && ( bell_count == x.bell_count ) && ( ds == x.ds );
-    }
+    bool operator==( const Framebuffer &x ) const;
   };
 }
 
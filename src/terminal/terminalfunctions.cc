@@ -44,9 +44,7 @@ using namespace Terminal;
 
 static void clearline( Framebuffer *fb, int row, int start, int end )
 {
-  for ( int col = start; col <= end; col++ ) {
-    fb->reset_cell( fb->get_mutable_cell( row, col ) );
-  }
+  fb->reset_cells( row, start, end + 1 );
 }
 
 /* erase in line */
@@ -60,7 +58,7 @@ void CSI_EL( Framebuffer *fb, Dispatcher *dispatch )
     clearline( fb, -1, 0, fb->ds.get_cursor_col() );
     break;
   case 2: /* all of line */
-    fb->reset_row( fb->get_mutable_row( -1 ) );
+    fb->reset_row( -1 );
     break;
   }
 }
@@ -73,18 +71,18 @@ void CSI_ED( Framebuffer *fb, Dispatcher *dispatch ) {
   case 0: /* active position to end of screen, inclusive */
     clearline( fb, -1, fb->ds.get_cursor_col(), fb->ds.get_width() - 1 );
     for ( int y = fb->ds.get_cursor_row() + 1; y < fb->ds.get_height(); y++ ) {
-      fb->reset_row( fb->get_mutable_row( y ) );
+      fb->reset_row( y );
     }
     break;
   case 1: /* start of screen to active position, inclusive */
     for ( int y = 0; y < fb->ds.get_cursor_row(); y++ ) {
-      fb->reset_row( fb->get_mutable_row( y ) );
+      fb->reset_row( y );
     }
     clearline( fb, -1, 0, fb->ds.get_cursor_col() );
     break;
   case 2: /* entire screen */
     for ( int y = 0; y < fb->ds.get_height(); y++ ) {
-      fb->reset_row( fb->get_mutable_row( y ) );
+      fb->reset_row( y );
     }
     break;
   }
@@ -148,7 +146,7 @@ void Esc_DECALN( Framebuffer *fb, Dispatcher *dispatch __attribute((unused)) )
   for ( int y = 0; y < fb->ds.get_height(); y++ ) {
     for ( int x = 0; x < fb->ds.get_width(); x++ ) {
       fb->reset_cell( fb->get_mutable_cell( y, x ) );
-      fb->get_mutable_cell( y, x )->contents.push_back( L'E' );
+      fb->get_mutable_cell( y, x )->append( L'E' );
     }
   }
 }
@@ -255,7 +253,7 @@ static bool *get_DEC_mode( int param, Framebuffer *fb ) {
     fb->ds.move_row( 0 );
     fb->ds.move_col( 0 );
     for ( int y = 0; y < fb->ds.get_height(); y++ ) {
-      fb->reset_row( fb->get_mutable_row( y ) );
+      fb->reset_row( y );
     }
     return NULL;
   case 5: /* reverse video */
@@ -382,24 +380,41 @@ static Function func_Ctrl_BEL( CONTROL, "\x07", Ctrl_BEL );
 /* select graphics rendition -- e.g., bold, blinking, etc. */
 void CSI_SGR( Framebuffer *fb, Dispatcher *dispatch )
 {
-  /* We need to special-case the handling of CSI [34]8 ; 5 ; Ps m,
-     because Ps of 0 in that case does not mean reset to default, even
-     though it means that otherwise (as usually renditions are applied
-     in order). */
-
-  if ( (dispatch->param_count() == 3)
-       && (dispatch->getparam( 0, -1 ) == 38)
-       && (dispatch->getparam( 1, -1 ) == 5) ) {
-    fb->ds.set_foreground_color( dispatch->getparam( 2, 0 ) );
-  } else if ( (dispatch->param_count() == 3)
-	      && (dispatch->getparam( 0, -1 ) == 48)
-	      && (dispatch->getparam( 1, -1 ) == 5) ) {
-    fb->ds.set_background_color( dispatch->getparam( 2, 0 ) );
-  } else {
-    for ( int i = 0; i < dispatch->param_count(); i++ ) {
-      int rendition = dispatch->getparam( i, 0 );
-      fb->ds.add_rendition( rendition );
+  for ( int i = 0; i < dispatch->param_count(); i++ ) {
+    int rendition = dispatch->getparam( i, 0 );
+
+    /* We need to special-case the handling of [34]8 ; 5 ; Ps and
+       [34]8 ; 2 ; Pr ; Pg ; Pb, because a parameter of 0 in those
+       cases does not mean reset to default, even though it means
+       that otherwise (as usually renditions are applied in order). */
+    if ( (rendition == 38) || (rendition == 48) ) {
+      int remaining = dispatch->param_count() - i - 1;
+      int kind = dispatch->getparam( i + 1, -1 );
+
+      if ( (kind == 5) && (remaining >= 2) ) {
+	int color = dispatch->getparam( i + 2, 0 );
+	if ( rendition == 38 ) {
+	  fb->ds.set_foreground_color( color );
+	} else {
+	  fb->ds.set_background_color( color );
+	}
+	i += 2;
+	continue;
+      } else if ( (kind == 2) && (remaining >= 4) ) {
+	int red = dispatch->getparam( i + 2, 0 );
+	int green = dispatch->getparam( i + 3, 0 );
+	int blue = dispatch->getparam( i + 4, 0 );
+	if ( rendition == 38 ) {
+	  fb->ds.set_foreground_rgb( red, green, blue );
+	} else {
+	  fb->ds.set_background_rgb( red, green, blue );
+	}
+	i += 4;
+	continue;
+      }
     }
+
+    fb->ds.add_rendition( rendition );
   }
 }
 
@@ -445,9 +460,7 @@ void CSI_IL( Framebuffer *fb, Dispatcher *dispatch )
 {
   int lines = dispatch->getparam( 0, 1 );
 
-  for ( int i = 0; i < lines; i++ ) {
-    fb->insert_line( fb->ds.get_cursor_row() );
-  }
+  fb->insert_line( fb->ds.get_cursor_row(), lines );
 
   /* vt220 manual and Ecma-48 say to move to first column */
   /* but xterm and gnome-terminal don't */
@@ -461,9 +474,7 @@ void CSI_DL( Framebuffer *fb, Dispatcher *dispatch )
 {
   int lines = dispatch->getparam( 0, 1 );
 
-  for ( int i = 0; i < lines; i++ ) {
-    fb->delete_line( fb->ds.get_cursor_row() );
-  }
+  fb->delete_line( fb->ds.get_cursor_row(), lines );
 
   /* same story -- xterm and gnome-terminal don't
      move to first column */
@@ -477,9 +488,7 @@ void CSI_ICH( Framebuffer *fb, Dispatcher *dispatch )
 {
   int cells = dispatch->getparam( 0, 1 );
 
-  for ( int i = 0; i < cells; i++ ) {
-    fb->insert_cell( fb->ds.get_cursor_row(), fb->ds.get_cursor_col() );
-  }
+  fb->insert_cell( fb->ds.get_cursor_row(), fb->ds.get_cursor_col(), cells );
 }
 
 static Function func_CSI_ICH( CSI, "@", CSI_ICH );
@@ -489,9 +498,7 @@ void CSI_DCH( Framebuffer *fb, Dispatcher *dispatch )
 {
   int cells = dispatch->getparam( 0, 1 );
 
-  for ( int i = 0; i < cells; i++ ) {
-    fb->delete_cell( fb->ds.get_cursor_row(), fb->ds.get_cursor_col() );
-  }
+  fb->delete_cell( fb->ds.get_cursor_row(), fb->ds.get_cursor_col(), cells );
 }
 
 static Function func_CSI_DCH( CSI, "P", CSI_DCH );
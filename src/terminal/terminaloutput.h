@@ -0,0 +1,90 @@
+/*
+    Mosh: the mobile shell
+    Copyright 2012 Keith Winstein
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations including
+    the two.
+
+    You must obey the GNU General Public License in all respects for all
+    of the code used other than OpenSSL. If you modify file(s) with this
+    exception, you may extend this exception to your version of the
+    file(s), but you are not obligated to do so. If you do not wish to do
+    so, delete this exception statement from your version. If you delete
+    this exception statement from all source files in the program, then
+    also delete it here.
+*/
+
+#ifndef TERMINALOUTPUT_HPP
+#define TERMINALOUTPUT_HPP
+
+#include <wchar.h>
+#include <string>
+
+/* Helpers for writing escape sequences and text to the terminal,
+   without snprintf() or the locale: output is always UTF-8. */
+
+namespace Terminal {
+  /* decimal digits of a non-negative number */
+  inline void append_decimal( std::string &out, int n )
+  {
+    char digits[ 16 ];
+    char *p = digits + sizeof( digits );
+    unsigned int u = n;
+    do {
+      *--p = '0' + u % 10;
+      u /= 10;
+    } while ( u );
+    out.append( p, digits + sizeof( digits ) - p );
+  }
+
+  /* one character, encoded as UTF-8; anything that is not a Unicode
+     scalar value becomes U+FFFD */
+  inline void append_utf8( std::string &out, wchar_t ch )
+  {
+    unsigned long c = ch;
+    if ( c < 0x80 ) {
+      out.push_back( char( c ) );
+      return;
+    }
+
+    if ( (c > 0x10FFFF) || ((c >= 0xD800) && (c <= 0xDFFF)) ) {
+      c = 0xFFFD;
+    }
+
+    char b[ 4 ];
+    size_t len;
+    if ( c < 0x800 ) {
+      b[ 0 ] = 0xC0 | (c >> 6);
+      len = 2;
+    } else if ( c < 0x10000 ) {
+      b[ 0 ] = 0xE0 | (c >> 12);
+      b[ 1 ] = 0x80 | ((c >> 6) & 0x3F);
+      len = 3;
+    } else {
+      b[ 0 ] = 0xF0 | (c >> 18);
+      b[ 1 ] = 0x80 | ((c >> 12) & 0x3F);
+      b[ 2 ] = 0x80 | ((c >> 6) & 0x3F);
+      len = 4;
+    }
+    b[ len - 1 ] = 0x80 | (c & 0x3F);
+    out.append( b, len );
+  }
+}
+
+#endif
@@ -0,0 +1,60 @@
+/*
+    Mosh: the mobile shell
+    Copyright 2012 Keith Winstein
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations including
+    the two.
+
+    You must obey the GNU General Public License in all respects for all
+    of the code used other than OpenSSL. If you modify file(s) with this
+    exception, you may extend this exception to your version of the
+    file(s), but you are not obligated to do so. If you do not wish to do
+    so, delete this exception statement from your version. If you delete
+    this exception statement from all source files in the program, then
+    also delete it here.
+*/
+
+#ifndef TERMINALWIDTH_HPP
+#define TERMINALWIDTH_HPP
+
+#include <wchar.h>
+
+/* Column width of a character, as wcwidth() would give it in a glibc
+   UTF-8 locale, but from a table built into mosh: the answer does not
+   depend on the locale or C library of the host, so the server, the
+   client and its predictions all agree. The table is generated by
+   scripts/gen-width-table. */
+
+namespace Terminal {
+  extern const unsigned char width_index[ 0x110000 >> 8 ];
+  extern const unsigned char width_blocks[][ 64 ];
+
+  /* -1 for controls and unassigned code points, otherwise 0, 1 or 2 */
+  inline int char_width( wchar_t ch )
+  {
+    unsigned long cp = ch;
+    if ( cp >= 0x110000 ) {
+      return -1;
+    }
+    unsigned int bits = (width_blocks[ width_index[ cp >> 8 ] ][ (cp & 0xFF) >> 2 ] >> ((cp & 3) * 2)) & 3;
+    return (bits == 3) ? -1 : int( bits );
+  }
+}
+
+#endif
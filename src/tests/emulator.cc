@@ -0,0 +1,218 @@
+/*
+    Mosh: the mobile shell
+    Copyright 2012 Keith Winstein
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations including
+    the two.
+
+    You must obey the GNU General Public License in all respects for all
+    of the code used other than OpenSSL. If you modify file(s) with this
+    exception, you may extend this exception to your version of the
+    file(s), but you are not obligated to do so. If you do not wish to do
+    so, delete this exception statement from your version. If you delete
+    this exception statement from all source files in the program, then
+    also delete it here.
+*/
+
+
+/* Tests of the terminal emulator: input is parsed and applied to an
+   Emulator, and the framebuffer is checked afterwards. */
+
+#include <stdio.h>
+#include <string.h>
+#include <locale.h>
+#include <wchar.h>
+#include <string>
+#include <algorithm>
+
+#include "parser.h"
+#include "terminal.h"
+#include "terminaloutput.h"
+#include "locale_utils.h"
+#include "fatal_assert.h"
+
+using namespace Terminal;
+
+bool verbose = false;
+
+static void feed( Parser::UTF8Parser &parser, Emulator &term, const std::string &s )
+{
+  parser.input( s.data(), s.size(), term );
+}
+
+static bool cell_is( const Emulator &term, int row, int col, const wchar_t *want )
+{
+  const Cell *cell = term.get_fb().get_cell( row, col );
+  size_t len = wcslen( want );
+  if ( verbose ) {
+    fprintf( stderr, "(%d, %d):", row, col );
+    for ( size_t i = 0; i < cell->contents_size(); i++ ) {
+      fprintf( stderr, " U+%04X", (unsigned int)cell->contents_data()[ i ] );
+    }
+    fprintf( stderr, "\n" );
+  }
+  return ( cell->contents_size() == len )
+    && ( std::equal( want, want + len, cell->contents_data() ) );
+}
+
+/* More distinct combining sequences than ever fit on one screen:
+   they must all come and go without losing later ones. */
+static void test_combining_sequences( void )
+{
+  Emulator term( 80, 24 );
+  Parser::UTF8Parser parser;
+
+  std::string s;
+  for ( int i = 0; i < 70000; i++ ) {
+    append_utf8( s, 0x4E00 + i % 20000 ); /* CJK ideographs */
+    append_utf8( s, 0x300 + i / 20000 ); /* combining diacritical marks */
+  }
+  feed( parser, term, s );
+
+  s = "\033[H\033[2J";
+  append_utf8( s, L'e' );
+  append_utf8( s, 0x301 );
+  feed( parser, term, s );
+  const wchar_t e_acute[] = { L'e', 0x301, 0 };
+  fatal_assert( cell_is( term, 0, 0, e_acute ) );
+
+  /* insert and delete move cells (and their sequences) around */
+  const wchar_t a_grave[] = { L'a', 0x300, 0 };
+  for ( int i = 0; i < 1000; i++ ) {
+    s = "\033[H\033[K";
+    append_utf8( s, L'a' );
+    append_utf8( s, 0x300 );
+    s += "\033[H\033[3@";
+    feed( parser, term, s );
+    fatal_assert( cell_is( term, 0, 3, a_grave ) );
+
+    feed( parser, term, "\033[H\033[2P" );
+    fatal_assert( cell_is( term, 0, 1, a_grave ) );
+  }
+}
+
+/* ICH, DCH and insert-mode printing at the last column shift
+   nothing, only replace that one cell */
+static void test_shift_at_last_column( void )
+{
+  Emulator term( 10, 3 );
+  Parser::UTF8Parser parser;
+  const wchar_t i[] = { L'i', 0 };
+  const wchar_t z[] = { L'Z', 0 };
+  const wchar_t blank[] = { 0 };
+
+  feed( parser, term, "abcdefghij\033[1;10H\033[999@" );
+  fatal_assert( cell_is( term, 0, 8, i ) );
+  fatal_assert( cell_is( term, 0, 9, blank ) );
+
+  feed( parser, term, "\033[1;10Hj\033[1;10H\033[@" );
+  fatal_assert( cell_is( term, 0, 9, blank ) );
+
+  feed( parser, term, "\033[1;10Hj\033[1;10H\033[P" );
+  fatal_assert( cell_is( term, 0, 8, i ) );
+  fatal_assert( cell_is( term, 0, 9, blank ) );
+
+  feed( parser, term, "\033[1;10Hj\033[1;10H\033[999P" );
+  fatal_assert( cell_is( term, 0, 9, blank ) );
+
+  feed( parser, term, "\033[1;10Hj\033[1;10H\033[4hZ\033[4l" );
+  fatal_assert( cell_is( term, 0, 8, i ) );
+  fatal_assert( cell_is( term, 0, 9, z ) );
+}
+
+/* With origin mode set, a cursor outside the scrolling region snaps
+   inside it on the first row of an SU/SD scroll and moves on from
+   there, as if the lines had been scrolled one at a time. */
+static void test_scroll_outside_margins( void )
+{
+  Emulator term( 80, 24 );
+  Parser::UTF8Parser parser;
+
+  /* region is rows 2 to 5; DECOM homes the cursor to row 0 before
+     the margins apply */
+  feed( parser, term, "\033[3;6r\033[?6h" );
+  fatal_assert( term.get_fb().ds.get_cursor_row() == 0 );
+
+  feed( parser, term, "\033[3T" );
+  fatal_assert( term.get_fb().ds.get_cursor_row() == 4 );
+}
+
+/* the next row generation; every print draws at least one */
+static uint64_t next_gen( void )
+{
+  return Row( 1, 0 ).gen;
+}
+
+/* REP leaves the screen as that many prints would, without doing
+   them all once the rest would only repeat what is already there */
+static void test_repeat( void )
+{
+  Emulator term( 80, 24 );
+  Parser::UTF8Parser parser;
+  const wchar_t x[] = { L'x', 0 };
+  const wchar_t y[] = { L'y', 0 };
+  const wchar_t blank[] = { 0 };
+
+  /* 65536 = 819 rows of 80, and 16 more */
+  uint64_t start = next_gen();
+  feed( parser, term, "x\033[65535b" );
+  fatal_assert( next_gen() - start < 65535 );
+  fatal_assert( cell_is( term, 0, 0, x ) );
+  fatal_assert( cell_is( term, 22, 79, x ) );
+  fatal_assert( cell_is( term, 23, 15, x ) );
+  fatal_assert( cell_is( term, 23, 16, blank ) );
+  fatal_assert( term.get_fb().ds.get_cursor_row() == 23 );
+  fatal_assert( term.get_fb().ds.get_cursor_col() == 16 );
+
+  /* without autowrap, the repeats stop at the right margin */
+  feed( parser, term, "\033[?7l\033[H\033[2J" );
+  start = next_gen();
+  feed( parser, term, "y\033[65535b" );
+  fatal_assert( next_gen() - start < 1000 );
+  fatal_assert( cell_is( term, 0, 79, y ) );
+  fatal_assert( cell_is( term, 1, 0, blank ) );
+  fatal_assert( term.get_fb().ds.get_cursor_row() == 0 );
+  fatal_assert( term.get_fb().ds.get_cursor_col() == 79 );
+}
+
+int main( int argc, char *argv[] )
+{
+  if ( argc >= 2 && strcmp( argv[ 1 ], "-v" ) == 0 ) {
+    verbose = true;
+  }
+
+  set_native_locale();
+  if ( !is_utf8_locale() ) {
+    static const char *const fallbacks[] = { "C.UTF-8", "en_US.UTF-8", "C.utf8" };
+    for ( size_t i = 0; i < 3 && !is_utf8_locale(); i++ ) {
+      setlocale( LC_CTYPE, fallbacks[ i ] );
+    }
+  }
+  if ( !is_utf8_locale() ) {
+    fprintf( stderr, "Skipping: needs a UTF-8 locale for wcwidth().\n" );
+    return 77;
+  }
+
+  test_combining_sequences();
+  test_shift_at_last_column();
+  test_scroll_outside_margins();
+  test_repeat();
+
+  return 0;
+}
@@ -0,0 +1,313 @@
+/*
+    Mosh: the mobile shell
+    Copyright 2012 Keith Winstein
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations including
+    the two.
+
+    You must obey the GNU General Public License in all respects for all
+    of the code used other than OpenSSL. If you modify file(s) with this
+    exception, you may extend this exception to your version of the
+    file(s), but you are not obligated to do so. If you do not wish to do
+    so, delete this exception statement from your version. If you delete
+    this exception statement from all source files in the program, then
+    also delete it here.
+*/
+
+/* Tests the UTF-8 decoder in Parser::UTF8Parser against the mbrtowc()
+   decoder it replaced, by feeding both the same octets (the new one in
+   randomly sized pieces) and comparing the actions that come out of
+   the parser. */
+
+#include <stdio.h>
+#include <string.h>
+#include <locale.h>
+#include <wchar.h>
+#include <stdint.h>
+#include <string>
+#include <algorithm>
+#include <vector>
+
+#include "parser.h"
+#include "locale_utils.h"
+#include "prng.h"
+#include "fatal_assert.h"
+
+PRNG prng;
+
+bool verbose = false;
+
+/* records the parser's output as (action, character) pairs */
+class Recorder {
+public:
+  std::vector< std::pair<std::string, wchar_t> > actions;
+
+  Recorder() : actions() {}
+
+  template <class T>
+  void act( const T &action )
+  {
+    T copy( action );
+    actions.push_back( std::make_pair( copy.name(), copy.char_present ? copy.ch : -1 ) );
+  }
+
+  void print_run( const char *s, size_t len )
+  {
+    for ( size_t i = 0; i < len; i++ ) {
+      actions.push_back( std::make_pair( std::string( "Print" ), wchar_t( s[ i ] ) ) );
+    }
+  }
+};
+
+/* the old decoder, using the locale's mbrtowc() */
+class ReferenceDecoder {
+private:
+  char buf[ 8 ];
+  size_t buf_len;
+
+public:
+  ReferenceDecoder() : buf_len( 0 ) {}
+
+  void input( char c, std::vector<wchar_t> &out )
+  {
+    fatal_assert( buf_len < sizeof( buf ) );
+    buf[ buf_len++ ] = c;
+
+    wchar_t pwc;
+    mbstate_t ps;
+    memset( &ps, 0, sizeof( ps ) );
+
+    size_t total_bytes_parsed = 0;
+    size_t orig_buf_len = buf_len;
+
+    while ( total_bytes_parsed != orig_buf_len ) {
+      size_t bytes_parsed = mbrtowc( &pwc, buf, buf_len, &ps );
+
+      if ( bytes_parsed == 0 ) {
+	buf_len = 0;
+	pwc = L'\0';
+	bytes_parsed = 1;
+      } else if ( bytes_parsed == (size_t) -1 ) {
+	if ( buf_len > 1 ) {
+	  buf[ 0 ] = buf[ buf_len - 1 ];
+	  bytes_parsed = buf_len - 1;
+	  buf_len = 1;
+	} else {
+	  buf_len = 0;
+	  bytes_parsed = 1;
+	}
+	pwc = (wchar_t) 0xFFFD;
+      } else if ( bytes_parsed == (size_t) -2 ) {
+	total_bytes_parsed += buf_len;
+	continue;
+      } else {
+	memmove( buf, buf + bytes_parsed, buf_len - bytes_parsed );
+	buf_len = buf_len - bytes_parsed;
+      }
+
+      uint64_t pwcheck = pwc;
+      if ( pwcheck > 0x10FFFF ) {
+	pwc = (wchar_t) 0xFFFD;
+      }
+      if ( (pwcheck >= 0xD800) && (pwcheck <= 0xDFFF) ) {
+	pwc = (wchar_t) 0xFFFD;
+      }
+
+      out.push_back( pwc );
+      total_bytes_parsed += bytes_parsed;
+    }
+  }
+};
+
+Recorder reference( const std::string &s )
+{
+  ReferenceDecoder decoder;
+  Parser::Parser parser;
+  Recorder out;
+
+  for ( size_t i = 0; i < s.size(); i++ ) {
+    std::vector<wchar_t> chars;
+    decoder.input( s[ i ], chars );
+    for ( size_t j = 0; j < chars.size(); j++ ) {
+      parser.input( chars[ j ], out );
+    }
+  }
+
+  return out;
+}
+
+Recorder decode( const std::string &s, bool split )
+{
+  Parser::UTF8Parser parser;
+  Recorder out;
+
+  size_t i = 0;
+  while ( i < s.size() ) {
+    size_t len = s.size() - i;
+    if ( split ) {
+      len = std::min( len, size_t( prng.uint8() % 8 ) );
+    }
+    if ( len == 1 && prng.uint8() % 2 ) {
+      parser.input( s[ i ], out );
+    } else {
+      parser.input( s.data() + i, len, out );
+    }
+    i += len;
+  }
+
+  return out;
+}
+
+void dump( FILE *out, const std::string &s )
+{
+  for ( size_t i = 0; i < s.size(); i++ ) {
+    fprintf( out, "%02x ", (unsigned char)s[ i ] );
+  }
+  fprintf( out, "\n" );
+}
+
+void test_one( const std::string &s, bool split )
+{
+  if ( verbose ) {
+    dump( stdout, s );
+  }
+
+  bool same = (reference( s ).actions == decode( s, split ).actions);
+  if ( !same ) {
+    fprintf( stderr, "Mismatch on input: " );
+    dump( stderr, s );
+  }
+  fatal_assert( same );
+}
+
+/* well-formed UTF-8 for a random scalar value, weighted towards
+   the boundaries of each length */
+std::string random_char( void )
+{
+  static const uint32_t edges[] = { 0, 0x7F, 0x80, 0x7FF, 0x800, 0xD7FF, 0xE000,
+				    0xFFFD, 0xFFFF, 0x10000, 0x10FFFF };
+  uint32_t c;
+  if ( prng.uint8() % 4 == 0 ) {
+    c = edges[ prng.uint8() % (sizeof( edges ) / sizeof( edges[ 0 ] )) ];
+  } else {
+    do {
+      c = prng.uint32() % 0x110000;
+    } while ( (c >= 0xD800) && (c <= 0xDFFF) );
+  }
+
+  char b[ 4 ];
+  size_t n;
+  if ( c < 0x80 ) {
+    b[ 0 ] = c; n = 1;
+  } else if ( c < 0x800 ) {
+    b[ 0 ] = 0xC0 | (c >> 6); b[ 1 ] = 0x80 | (c & 0x3F); n = 2;
+  } else if ( c < 0x10000 ) {
+    b[ 0 ] = 0xE0 | (c >> 12); b[ 1 ] = 0x80 | ((c >> 6) & 0x3F); b[ 2 ] = 0x80 | (c & 0x3F); n = 3;
+  } else {
+    b[ 0 ] = 0xF0 | (c >> 18); b[ 1 ] = 0x80 | ((c >> 12) & 0x3F);
+    b[ 2 ] = 0x80 | ((c >> 6) & 0x3F); b[ 3 ] = 0x80 | (c & 0x3F); n = 4;
+  }
+  return std::string( b, n );
+}
+
+std::string random_text( bool well_formed )
+{
+  static const char *const pieces[] = { "\033[1;31m", "\033]0;title\007", "\033P1|x\033\\",
+					"\r\n", "plain text ", "\t" };
+  std::string s;
+  size_t n = prng.uint8() % 64;
+  for ( size_t i = 0; i < n; i++ ) {
+    switch ( prng.uint8() % (well_formed ? 3 : 6) ) {
+    case 0: s += random_char(); break;
+    case 1: s += pieces[ prng.uint8() % (sizeof( pieces ) / sizeof( pieces[ 0 ] )) ]; break;
+    case 2: s += char( 0x20 + prng.uint8() % 0x5F ); break;
+    case 3: s += char( prng.uint8() ); break; /* anything at all */
+    case 4: s += random_char().substr( 1 ); break; /* lost its lead octet */
+    case 5: { /* overlong, surrogate, out of range or five or six octets */
+	std::string c = random_char();
+	size_t len = 2 + prng.uint8() % 5;
+	s += char( (0xFF00 >> len) | (prng.uint8() & (0x7F >> len)) );
+	for ( size_t j = 1; j < len; j++ ) {
+	  s += char( 0x80 | (prng.uint8() & 0x3F) );
+	}
+	s += c.substr( 0, prng.uint8() % (c.size() + 1) ); /* maybe cut short */
+      }
+      break;
+    }
+  }
+  return s;
+}
+
+int main( int argc, char *argv[] )
+{
+  if ( argc >= 2 && strcmp( argv[ 1 ], "-v" ) == 0 ) {
+    verbose = true;
+  }
+
+  set_native_locale();
+  if ( !is_utf8_locale() ) {
+    static const char *const fallbacks[] = { "C.UTF-8", "en_US.UTF-8", "C.utf8" };
+    for ( size_t i = 0; i < 3 && !is_utf8_locale(); i++ ) {
+      setlocale( LC_CTYPE, fallbacks[ i ] );
+    }
+  }
+  if ( !is_utf8_locale() ) {
+    fprintf( stderr, "Skipping: needs a UTF-8 locale for mbrtowc().\n" );
+    return 77;
+  }
+
+  /* The new decoder reproduces glibc's handling of ill-formed
+     input. Other C libraries treat some of it differently, and
+     only well-formed input is compared there. */
+  const std::string probe( "\xed\xa0\x80\xf4\x90\x80\x80\xf8\x88\x80\x80\x80\xe0\x80\x80" );
+  ReferenceDecoder probe_decoder;
+  std::vector<wchar_t> probe_chars;
+  for ( size_t i = 0; i < probe.size(); i++ ) {
+    probe_decoder.input( probe[ i ], probe_chars );
+  }
+  bool ill_formed = (probe_chars == std::vector<wchar_t>( 6, 0xFFFD ));
+  if ( !ill_formed ) {
+    fprintf( stderr, "C library decodes ill-formed UTF-8 differently; checking well-formed input only.\n" );
+  }
+
+  if ( ill_formed ) {
+    /* every sequence of up to four octets drawn from the interesting ones */
+    static const unsigned char octets[] = { 0x00, 0x1B, 0x41, 0x5B, 0x7F, 0x80, 0x8F, 0x90, 0x9F,
+					    0xA0, 0xBF, 0xC0, 0xC1, 0xC2, 0xDF, 0xE0, 0xED, 0xEF,
+					    0xF0, 0xF4, 0xF5, 0xF8, 0xFC, 0xFE, 0xFF };
+    const size_t n = sizeof( octets );
+    for ( size_t a = 0; a < n; a++ ) {
+      for ( size_t b = 0; b < n; b++ ) {
+	for ( size_t c = 0; c < n; c++ ) {
+	  for ( size_t d = 0; d < n; d++ ) {
+	    char s[ 5 ] = { char( octets[ a ] ), char( octets[ b ] ), char( octets[ c ] ),
+			    char( octets[ d ] ), 'x' };
+	    test_one( std::string( s, 5 ), false );
+	  }
+	}
+      }
+    }
+  }
+
+  for ( size_t i = 0; i < 20000; i++ ) {
+    test_one( random_text( !ill_formed || (i % 2 == 0) ), true );
+  }
+
+  return 0;
+}
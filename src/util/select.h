@@ -63,12 +63,16 @@ private:
     /* These initializations are not used; they are just
        here to appease -Weffc++. */
     , all_fds( dummy_fd_set )
+    , all_write_fds( dummy_fd_set )
     , read_fds( dummy_fd_set )
+    , write_fds( dummy_fd_set )
     , error_fds( dummy_fd_set )
     , empty_sigset( dummy_sigset )
   {
     FD_ZERO( &all_fds );
+    FD_ZERO( &all_write_fds );
     FD_ZERO( &read_fds );
+    FD_ZERO( &write_fds );
     FD_ZERO( &error_fds );
 
     clear_got_signal();
@@ -93,9 +97,20 @@ public:
     FD_SET( fd, &all_fds );
   }
 
+  /* wait for fd to become writable; errors on it are reported too,
+     but it is only waited on to become readable if also added */
+  void add_write_fd( int fd )
+  {
+    if ( fd > max_fd ) {
+      max_fd = fd;
+    }
+    FD_SET( fd, &all_write_fds );
+  }
+
   void clear_fds( void )
   {
     FD_ZERO( &all_fds );
+    FD_ZERO( &all_write_fds );
   }
 
   void add_signal( int signum )
@@ -122,7 +137,13 @@ public:
   int select( int timeout )
   {
     memcpy( &read_fds,  &all_fds, sizeof( read_fds  ) );
+    memcpy( &write_fds, &all_write_fds, sizeof( write_fds ) );
     memcpy( &error_fds, &all_fds, sizeof( error_fds ) );
+    for ( int fd = 0; fd <= max_fd; fd++ ) {
+      if ( FD_ISSET( fd, &all_write_fds ) ) {
+	FD_SET( fd, &error_fds );
+      }
+    }
     clear_got_signal();
     got_any_signal = 0;
 
@@ -136,7 +157,7 @@ public:
       tsp = &ts;
     }
 
-    int ret = ::pselect( max_fd + 1, &read_fds, NULL, &error_fds, tsp, &empty_sigset );
+    int ret = ::pselect( max_fd + 1, &read_fds, &write_fds, &error_fds, tsp, &empty_sigset );
 #else
     struct timeval tv;
     struct timeval *tvp = NULL;
@@ -150,7 +171,7 @@ public:
 
     int ret = sigprocmask( SIG_SETMASK, &empty_sigset, &old_sigset );
     if ( ret != -1 ) {
-      ret = ::select( max_fd + 1, &read_fds, NULL, &error_fds, tvp );
+      ret = ::select( max_fd + 1, &read_fds, &write_fds, &error_fds, tvp );
       sigprocmask( SIG_SETMASK, &old_sigset, NULL );
     }
 #endif
@@ -158,6 +179,7 @@ public:
     if ( ( ret == -1 ) && ( errno == EINTR ) ) {
       /* The user should process events as usual. */
       FD_ZERO( &read_fds );
+      FD_ZERO( &write_fds );
       FD_ZERO( &error_fds );
       ret = 0;
     }
@@ -176,12 +198,21 @@ public:
     return FD_ISSET( fd, &read_fds );
   }
 
+  bool write( int fd )
+#if FD_ISSET_IS_CONST
+    const
+#endif
+  {
+    assert( FD_ISSET( fd, &all_fds ) || FD_ISSET( fd, &all_write_fds ) );
+    return FD_ISSET( fd, &write_fds );
+  }
+
   bool error( int fd )
 #if FD_ISSET_IS_CONST
     const
 #endif
   {
-    assert( FD_ISSET( fd, &all_fds ) );
+    assert( FD_ISSET( fd, &all_fds ) || FD_ISSET( fd, &all_write_fds ) );
     return FD_ISSET( fd, &error_fds );
   }
 
@@ -209,7 +240,7 @@ private:
   int got_any_signal;
   int got_signal[ MAX_SIGNAL_NUMBER + 1 ];
 
-  fd_set all_fds, read_fds, error_fds;
+  fd_set all_fds, all_write_fds, read_fds, write_fds, error_fds;
 
   sigset_t empty_sigset;
 